@@ -71,6 +71,9 @@ mosh.CommandInstance = function(argv) {
   // Whether the NaCl module is running.
   this.running_ = false;
 
+  // Number of display messages printed but not yet acknowledged to NaCl.
+  this.pendingDisplayAcks_ = 0;
+
   // Port to an SSH agent.
   this.agentPort_ = null;
 
@@ -140,7 +143,9 @@ mosh.CommandInstance.prototype.discoverAgentThenInsertMosh = function() {
         console.error(message);
         return;
       }
-      this.moshNaCl_.postMessage({'ssh_agent': message['data']});
+      // The agent speaks in arrays of bytes; NaCl takes an ArrayBuffer.
+      var data = new Uint8Array(message['data']).buffer;
+      this.moshNaCl_.postMessage({'ssh_agent': data});
     }.bind(this));
 
     this.moshNaCl_.setAttribute('use-agent', true);
@@ -177,7 +182,10 @@ mosh.CommandInstance.prototype.onMessage_ = function(e) {
   var type = e.data['type'];
   if (type == 'display') {
     this.io.print(data);
+    this.ackDisplay_();
   } else if (type == 'log') {
+    // Log lines are held by Mosh until there is an error, Mosh exits, or
+    // requestLog() asks for them.
     console.log(String(data));
   } else if (type == 'error') {
     // TODO: Find a way to output errors that doesn't interfere with the
@@ -220,8 +228,39 @@ mosh.CommandInstance.prototype.onMessage_ = function(e) {
     var j = JSON.stringify(param);
     param = JSON.parse(j);
     chrome.storage.sync.set(param);
+  } else if (type == 'known_hosts_lookup') {
+    // Only the entries asked for (by name) are sent, rather than the whole
+    // known hosts database.
+    var thiz = this;
+    chrome.storage.sync.get('known_hosts', function(o) {
+      var knownHosts = o['known_hosts'] || {};
+      var entries = {};
+      data.forEach(function(name) {
+        if (knownHosts.hasOwnProperty(name)) {
+          entries[name] = knownHosts[name];
+        }
+      });
+      thiz.moshNaCl_.postMessage({'known_hosts': entries});
+    });
+  } else if (type == 'known_hosts_update') {
+    // Only new and changed entries are sent; merge them in.
+    chrome.storage.sync.get('known_hosts', function(o) {
+      var knownHosts = o['known_hosts'] || {};
+      for (var name in data) {
+        knownHosts[name] = String(data[name]);
+      }
+      chrome.storage.sync.set({'known_hosts': knownHosts});
+    });
   } else if (type == 'ssh-agent') {
     this.sendToAgent_(data);
+  } else if (type == 'latency_report') {
+    // Only sent when the "trace-latency" argument is "true".
+    console.log('Keystroke latency: ' + JSON.stringify(data));
+  } else if (type == 'io_trace') {
+    // Only sent when the "trace-io" argument is "true". Save the trace from
+    // the logged URL, and replay it with mosh_nacl/trace_replay.
+    var url = URL.createObjectURL(new Blob([data]));
+    console.log('I/O trace (' + data.byteLength + ' bytes): ' + url);
   } else if (type == 'exit') {
     this.exit_('Mosh has exited.');
   } else {
@@ -229,6 +268,24 @@ mosh.CommandInstance.prototype.onMessage_ = function(e) {
   }
 };
 
+// Ask for the keystroke latency histograms so far (for use from the developer
+// console). They arrive as a 'latency_report' message, and are logged.
+mosh.CommandInstance.prototype.requestLatencyReport = function() {
+  this.moshNaCl_.postMessage({'latency_report': true});
+};
+
+// Ask for the I/O trace so far (for use from the developer console). It
+// arrives as an 'io_trace' message.
+mosh.CommandInstance.prototype.requestIOTrace = function() {
+  this.moshNaCl_.postMessage({'io_trace': true});
+};
+
+// Ask for the log lines recorded so far (for use from the developer console).
+// They arrive as a 'log' message.
+mosh.CommandInstance.prototype.requestLog = function() {
+  this.moshNaCl_.postMessage({'flush_log': true});
+};
+
 mosh.CommandInstance.prototype.sendKeyboard_ = function(string) {
   if (this.running_) {
     const te = new TextEncoder();
@@ -238,6 +295,27 @@ mosh.CommandInstance.prototype.sendKeyboard_ = function(string) {
   }
 };
 
+// Acknowledge a printed display message. NaCl stops sending output while too
+// much is unacknowledged, so acknowledgements are held until hterm has had a
+// chance to render (batched into one message per frame). The timeout covers
+// hidden windows, which don't get animation frames.
+mosh.CommandInstance.prototype.ackDisplay_ = function() {
+  this.pendingDisplayAcks_++;
+  if (this.pendingDisplayAcks_ > 1) {
+    // Already scheduled.
+    return;
+  }
+  var send = function() {
+    if (this.pendingDisplayAcks_ == 0) {
+      return;
+    }
+    this.moshNaCl_.postMessage({'display_ack': this.pendingDisplayAcks_});
+    this.pendingDisplayAcks_ = 0;
+  }.bind(this);
+  window.requestAnimationFrame(send);
+  window.setTimeout(send, 250);
+};
+
 mosh.CommandInstance.prototype.onTerminalResize_ = function(w, h) {
   // Send new size as an int, with the width as the high 16 bits.
   this.moshNaCl_.postMessage({'window_change': (w << 16) + h});
@@ -287,8 +365,11 @@ mosh.CommandInstance.prototype.onCrash_ =
   this.running_ = false;
 };
 
-// Send data to an SSH agent.
+// Send data (an ArrayBuffer) to an SSH agent.
 mosh.CommandInstance.prototype.sendToAgent_ = function(data) {
-  var message = {'type': 'auth-agent@openssh.com', 'data': data};
+  var message = {
+    'type': 'auth-agent@openssh.com',
+    'data': Array.from(new Uint8Array(data)),
+  };
   this.agentPort_.postMessage(message);
 }
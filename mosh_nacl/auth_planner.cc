@@ -0,0 +1,131 @@
+// auth_planner.cc - Chooses the order of SSH authentication methods.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/auth_planner.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using ssh::AuthenticationType;
+using std::string;
+using std::vector;
+
+namespace {
+
+const struct {
+  AuthenticationType type;
+  const char* name;
+} kMethodNames[] = {
+    {AuthenticationType::kPassword, "password"},
+    {AuthenticationType::kPublicKey, "publickey"},
+    {AuthenticationType::kHostBased, "hostbased"},
+    {AuthenticationType::kInteractive, "keyboard-interactive"},
+    {AuthenticationType::kNone, "none"},
+};
+
+bool Contains(const vector<AuthenticationType>& auths,
+              const AuthenticationType auth) {
+  return std::find(auths.begin(), auths.end(), auth) != auths.end();
+}
+
+}  // anonymous namespace
+
+AuthPlanner::AuthPlanner(const vector<AuthenticationType>& auths,
+                         const vector<AuthenticationType>& remembered) {
+  for (const auto& auth : remembered) {
+    if (Contains(auths, auth) && !Contains(remaining_, auth)) {
+      remaining_.push_back(auth);
+    }
+  }
+  for (const auto& auth : auths) {
+    if (!Contains(remaining_, auth)) {
+      remaining_.push_back(auth);
+    }
+  }
+}
+
+bool AuthPlanner::Next(AuthenticationType* auth) {
+  if (authenticated_ || remaining_.empty()) {
+    return false;
+  }
+  current_ = remaining_.front();
+  remaining_.erase(remaining_.begin());
+  *auth = current_;
+  return true;
+}
+
+void AuthPlanner::Report(const Result result,
+                         const vector<AuthenticationType>& server_auths) {
+  switch (result) {
+    case Result::AUTHENTICATED:
+      authenticated_ = true;
+      succeeded_.push_back(current_);
+      return;
+    case Result::PARTIAL:
+      succeeded_.push_back(current_);
+      break;
+    case Result::FAILED:
+      break;
+      // No default case; compiler will complain if missing an enum value.
+  }
+  if (server_auths.empty()) {
+    return;
+  }
+  remaining_.erase(
+      std::remove_if(remaining_.begin(), remaining_.end(),
+                     [&server_auths](const AuthenticationType auth) {
+                       return !Contains(server_auths, auth);
+                     }),
+      remaining_.end());
+}
+
+string AuthPlanner::Encode(const vector<AuthenticationType>& auths) {
+  string encoded;
+  for (const auto& auth : auths) {
+    for (const auto& method : kMethodNames) {
+      if (method.type == auth) {
+        if (!encoded.empty()) {
+          encoded += ',';
+        }
+        encoded += method.name;
+        break;
+      }
+    }
+  }
+  return encoded;
+}
+
+vector<AuthenticationType> AuthPlanner::Decode(const string& encoded) {
+  vector<AuthenticationType> auths;
+  size_t start = 0;
+  while (start <= encoded.size()) {
+    size_t end = encoded.find(',', start);
+    if (end == string::npos) {
+      end = encoded.size();
+    }
+    const string name = encoded.substr(start, end - start);
+    for (const auto& method : kMethodNames) {
+      if (name == method.name) {
+        auths.push_back(method.type);
+        break;
+      }
+    }
+    start = end + 1;
+  }
+  return auths;
+}
@@ -0,0 +1,84 @@
+// auth_planner.h - Chooses the order of SSH authentication methods.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MOSH_NACL_AUTH_PLANNER_H_
+#define MOSH_NACL_AUTH_PLANNER_H_
+
+#include <string>
+#include <vector>
+
+#include "mosh_nacl/ssh.h"
+
+// AuthPlanner decides which authentication method to try next during an SSH
+// login. Each attempt costs at least a round trip (and often a prompt), so it
+// starts with the methods that logged into the host last time, and drops
+// methods as soon as the server stops offering them, e.g. after a partial
+// success.
+//
+// Usage: Call Next() for a method, try it, and Report() how it went, until
+// Next() returns false. Then check authenticated(), and remember succeeded()
+// for the next login to the host.
+class AuthPlanner {
+ public:
+  enum class Result {
+    FAILED,         // The method was denied, or skipped.
+    PARTIAL,        // The method was accepted, but more are required.
+    AUTHENTICATED,  // Logged in.
+  };
+
+  // |auths| are the methods both sides support, in order of preference.
+  // |remembered| are the methods that logged into the host last time, in the
+  // order they were used; those of them in |auths| are tried first.
+  AuthPlanner(const std::vector<ssh::AuthenticationType>& auths,
+              const std::vector<ssh::AuthenticationType>& remembered);
+  AuthPlanner(const AuthPlanner&) = delete;
+  AuthPlanner& operator=(const AuthPlanner&) = delete;
+  ~AuthPlanner() = default;
+
+  // Gets the next method to try. Returns false if there are none left, or if
+  // already authenticated.
+  bool Next(ssh::AuthenticationType* auth);
+
+  // Reports the |result| of the method last given by Next(). |server_auths|
+  // are the methods the server says can continue; any others still to be
+  // tried are dropped. Pass an empty list if the server didn't say.
+  void Report(Result result,
+              const std::vector<ssh::AuthenticationType>& server_auths);
+
+  bool authenticated() const { return authenticated_; }
+
+  // The methods that were accepted, fully or partially, in order.
+  const std::vector<ssh::AuthenticationType>& succeeded() const {
+    return succeeded_;
+  }
+
+  // Converts methods to and from the form kept in known hosts: their SSH
+  // protocol names (RFC 4252), separated by commas. Decode() skips names it
+  // doesn't know.
+  static std::string Encode(const std::vector<ssh::AuthenticationType>& auths);
+  static std::vector<ssh::AuthenticationType> Decode(
+      const std::string& encoded);
+
+ private:
+  // Methods yet to be tried, in order.
+  std::vector<ssh::AuthenticationType> remaining_;
+  std::vector<ssh::AuthenticationType> succeeded_;
+  ssh::AuthenticationType current_ = ssh::AuthenticationType::kNone;
+  bool authenticated_ = false;
+};
+
+#endif  // MOSH_NACL_AUTH_PLANNER_H_
@@ -0,0 +1,88 @@
+// auth_planner_test.cc - Tests for auth_planner.{h,cc}.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/auth_planner.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using ssh::AuthenticationType;
+using std::vector;
+
+namespace {
+
+const AuthenticationType kPassword = AuthenticationType::kPassword;
+const AuthenticationType kPublicKey = AuthenticationType::kPublicKey;
+const AuthenticationType kInteractive = AuthenticationType::kInteractive;
+
+// Collects what |planner| would try if every method failed.
+vector<AuthenticationType> Plan(AuthPlanner* planner) {
+  vector<AuthenticationType> plan;
+  AuthenticationType auth;
+  while (planner->Next(&auth)) {
+    plan.push_back(auth);
+    planner->Report(AuthPlanner::Result::FAILED, {});
+  }
+  return plan;
+}
+
+}  // anonymous namespace
+
+TEST(AuthPlannerTest, KeepsOrderWithoutHistory) {
+  AuthPlanner planner({kPublicKey, kInteractive, kPassword}, {});
+  EXPECT_EQ(vector<AuthenticationType>({kPublicKey, kInteractive, kPassword}),
+            Plan(&planner));
+  EXPECT_FALSE(planner.authenticated());
+}
+
+TEST(AuthPlannerTest, TriesRememberedMethodsFirst) {
+  AuthPlanner planner({kPublicKey, kInteractive, kPassword},
+                      {kPassword, kInteractive});
+  EXPECT_EQ(vector<AuthenticationType>({kPassword, kInteractive, kPublicKey}),
+            Plan(&planner));
+}
+
+TEST(AuthPlannerTest, IgnoresRememberedMethodsNoLongerOffered) {
+  AuthPlanner planner({kPublicKey, kPassword}, {kInteractive, kPassword});
+  EXPECT_EQ(vector<AuthenticationType>({kPassword, kPublicKey}),
+            Plan(&planner));
+}
+
+TEST(AuthPlannerTest, SkipsMethodsRejectedAfterPartialSuccess) {
+  AuthPlanner planner({kPublicKey, kInteractive, kPassword}, {});
+  AuthenticationType auth;
+  ASSERT_TRUE(planner.Next(&auth));
+  EXPECT_EQ(kPublicKey, auth);
+  planner.Report(AuthPlanner::Result::PARTIAL, {kInteractive});
+  ASSERT_TRUE(planner.Next(&auth));
+  EXPECT_EQ(kInteractive, auth);
+  planner.Report(AuthPlanner::Result::AUTHENTICATED, {});
+  EXPECT_FALSE(planner.Next(&auth));
+  EXPECT_TRUE(planner.authenticated());
+  EXPECT_EQ(vector<AuthenticationType>({kPublicKey, kInteractive}),
+            planner.succeeded());
+}
+
+TEST(AuthPlannerTest, EncodesMethodNames) {
+  const vector<AuthenticationType> auths = {kPublicKey, kInteractive};
+  EXPECT_EQ("publickey,keyboard-interactive", AuthPlanner::Encode(auths));
+  EXPECT_EQ(auths, AuthPlanner::Decode("publickey,keyboard-interactive"));
+  EXPECT_EQ(vector<AuthenticationType>({kPassword}),
+            AuthPlanner::Decode("gssapi-with-mic,password,"));
+  EXPECT_TRUE(AuthPlanner::Decode("").empty());
+}
@@ -0,0 +1,75 @@
+// caching_resolver.cc - Resolver that caches the results of another.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/caching_resolver.h"
+
+#include <time.h>
+
+using std::move;
+using std::string;
+using std::vector;
+
+void CachingResolver::Resolve(string domain_name, Type type,
+                              Callback callback) {
+  Key key(move(domain_name), type);
+  bool hit = false;
+  Authenticity authenticity = Authenticity::INSECURE;
+  vector<string> results;
+  {
+    pthread::MutexLock m(cache_lock_);
+    auto iter = cache_.find(key);
+    if (iter != cache_.end()) {
+      if (iter->second.expires > Now()) {
+        hit = true;
+        authenticity = iter->second.authenticity;
+        results = iter->second.results;
+      } else {
+        cache_.erase(iter);
+      }
+    }
+  }
+  if (hit) {
+    // Call outside the lock, as the callback may well resolve again.
+    callback(Error::OK, authenticity, move(results));
+    return;
+  }
+
+  const string name = key.first;
+  resolver_->Resolve(name, type,
+                     [this, key, callback](Error error,
+                                           Authenticity authenticity,
+                                           vector<string> results) {
+                       Resolved(key, callback, error, authenticity,
+                                move(results));
+                     });
+}
+
+void CachingResolver::Resolved(Key key, Callback callback, Error error,
+                               Authenticity authenticity,
+                               vector<string> results) {
+  if (error == Error::OK && !results.empty()) {
+    pthread::MutexLock m(cache_lock_);
+    cache_[move(key)] = {authenticity, results, Now() + ttl_seconds_};
+  }
+  callback(error, authenticity, move(results));
+}
+
+int64_t CachingResolver::Now() const {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec;
+}
@@ -0,0 +1,71 @@
+// caching_resolver.h - Resolver that caches the results of another.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MOSH_NACL_CACHING_RESOLVER_H_
+#define MOSH_NACL_CACHING_RESOLVER_H_
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mosh_nacl/pthread_locks.h"
+#include "mosh_nacl/resolver.h"
+
+// CachingResolver wraps another Resolver, and answers repeated lookups from
+// the results of earlier successful ones. Resolvers here don't report TTLs, so
+// every result is kept for the same |ttl_seconds|. Cached answers call the
+// callback before Resolve() returns.
+//
+// Resolve() can be called from any thread.
+class CachingResolver : public Resolver {
+ public:
+  CachingResolver() = delete;
+  CachingResolver(std::unique_ptr<Resolver> resolver, int ttl_seconds)
+      : resolver_(std::move(resolver)), ttl_seconds_(ttl_seconds) {}
+  CachingResolver(const CachingResolver&) = delete;
+  CachingResolver& operator=(const CachingResolver&) = delete;
+  virtual ~CachingResolver() = default;
+
+  void Resolve(std::string domain_name, Type type, Callback callback) override;
+  bool IsValidating() const override { return resolver_->IsValidating(); }
+
+ protected:
+  // Seconds on a monotonic clock. Virtual for testing.
+  virtual int64_t Now() const;
+
+ private:
+  struct Entry {
+    Authenticity authenticity;
+    std::vector<std::string> results;
+    int64_t expires;
+  };
+  using Key = std::pair<std::string, Type>;
+
+  // Caches a successful result, and passes it on to |callback|.
+  void Resolved(Key key, Callback callback, Error error,
+                Authenticity authenticity, std::vector<std::string> results);
+
+  std::unique_ptr<Resolver> resolver_;
+  const int ttl_seconds_;
+  std::map<Key, Entry> cache_;  // Guard with cache_lock_.
+  pthread::Mutex cache_lock_;
+};
+
+#endif  // MOSH_NACL_CACHING_RESOLVER_H_
@@ -0,0 +1,130 @@
+// caching_resolver_test.cc - Tests for caching_resolver.{h,cc}.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/caching_resolver.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mosh_nacl/make_unique.h"
+
+using std::move;
+using std::string;
+using std::vector;
+using util::make_unique;
+
+namespace {
+
+// Answers every lookup at once, and counts them.
+class FakeResolver : public Resolver {
+ public:
+  void Resolve(string domain_name, Type type, Callback callback) override {
+    ++lookups;
+    if (domain_name == "missing.example") {
+      callback(Error::NOT_RESOLVED, Authenticity::INSECURE, {});
+      return;
+    }
+    callback(Error::OK, Authenticity::AUTHENTIC,
+             {type == Type::A ? "192.0.2.1" : "2001:db8::1"});
+  }
+  bool IsValidating() const override { return true; }
+
+  int lookups = 0;
+};
+
+// Uses a clock the test controls.
+class TestCachingResolver : public CachingResolver {
+ public:
+  TestCachingResolver(std::unique_ptr<Resolver> resolver, int ttl_seconds)
+      : CachingResolver(move(resolver), ttl_seconds) {}
+
+  int64_t now = 1000;
+
+ protected:
+  int64_t Now() const override { return now; }
+};
+
+}  // anonymous namespace
+
+class CachingResolverTest : public ::testing::Test {
+ protected:
+  CachingResolverTest() {
+    auto fake = make_unique<FakeResolver>();
+    fake_ = fake.get();
+    resolver_ = make_unique<TestCachingResolver>(move(fake), 60);
+  }
+
+  // Resolves synchronously, which FakeResolver and the cache both allow.
+  vector<string> Resolve(const string& name, Resolver::Type type,
+                         Resolver::Error* error = nullptr) {
+    vector<string> results;
+    resolver_->Resolve(name, type, [&results, error](
+                                       Resolver::Error e,
+                                       Resolver::Authenticity authenticity,
+                                       vector<string> r) {
+      EXPECT_EQ(e == Resolver::Error::OK,
+                authenticity == Resolver::Authenticity::AUTHENTIC);
+      if (error != nullptr) {
+        *error = e;
+      }
+      results = move(r);
+    });
+    return results;
+  }
+
+  FakeResolver* fake_;  // Owned by |resolver_|.
+  std::unique_ptr<TestCachingResolver> resolver_;
+};
+
+TEST_F(CachingResolverTest, ReusesResults) {
+  EXPECT_EQ(vector<string>{"192.0.2.1"},
+            Resolve("host.example", Resolver::Type::A));
+  EXPECT_EQ(vector<string>{"192.0.2.1"},
+            Resolve("host.example", Resolver::Type::A));
+  EXPECT_EQ(1, fake_->lookups);
+  EXPECT_TRUE(resolver_->IsValidating());
+}
+
+TEST_F(CachingResolverTest, KeysOnNameAndType) {
+  Resolve("host.example", Resolver::Type::A);
+  EXPECT_EQ(vector<string>{"2001:db8::1"},
+            Resolve("host.example", Resolver::Type::AAAA));
+  Resolve("other.example", Resolver::Type::A);
+  EXPECT_EQ(3, fake_->lookups);
+}
+
+TEST_F(CachingResolverTest, Expires) {
+  Resolve("host.example", Resolver::Type::A);
+  resolver_->now += 59;
+  Resolve("host.example", Resolver::Type::A);
+  EXPECT_EQ(1, fake_->lookups);
+  resolver_->now += 1;
+  Resolve("host.example", Resolver::Type::A);
+  EXPECT_EQ(2, fake_->lookups);
+}
+
+TEST_F(CachingResolverTest, DoesNotCacheErrors) {
+  Resolver::Error error = Resolver::Error::OK;
+  EXPECT_TRUE(Resolve("missing.example", Resolver::Type::A, &error).empty());
+  EXPECT_EQ(Resolver::Error::NOT_RESOLVED, error);
+  Resolve("missing.example", Resolver::Type::A, &error);
+  EXPECT_EQ(Resolver::Error::NOT_RESOLVED, error);
+  EXPECT_EQ(2, fake_->lookups);
+}
@@ -0,0 +1,89 @@
+// latency_tracer.cc - Measures keystroke-to-display latency.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/latency_tracer.h"
+
+#include <time.h>
+#include <algorithm>
+
+const int LatencyTracer::kBuckets;
+const int64_t LatencyTracer::kMaxAge;
+const size_t LatencyTracer::kMaxPending;
+
+void LatencyTracer::Mark(Stage stage) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  MarkAt(stage, now.tv_sec * 1000000LL + now.tv_nsec / 1000);
+}
+
+void LatencyTracer::MarkAt(Stage stage, int64_t now_us) {
+  pthread::MutexLock m(lock_);
+
+  while (!pending_.empty() &&
+         (now_us - pending_.front().times[INPUT] > kMaxAge ||
+          pending_.size() >= kMaxPending)) {
+    pending_.pop_front();
+    ++report_.abandoned;
+  }
+
+  if (stage == INPUT) {
+    Trace trace;
+    trace.times[INPUT] = now_us;
+    trace.reached = INPUT;
+    pending_.push_back(trace);
+    return;
+  }
+
+  const Stage previous = static_cast<Stage>(stage - 1);
+  for (auto& trace : pending_) {
+    if (trace.reached == previous) {
+      trace.times[stage] = now_us;
+      trace.reached = stage;
+    }
+  }
+  if (stage != DISPLAY) {
+    return;
+  }
+
+  // Stages are reached in input order, so the completed traces are in front.
+  while (!pending_.empty() && pending_.front().reached == DISPLAY) {
+    const Trace& trace = pending_.front();
+    for (int s = READ; s < NUM_STAGES; ++s) {
+      Add(&report_.stages[s], trace.times[s] - trace.times[INPUT]);
+    }
+    ++report_.completed;
+    pending_.pop_front();
+  }
+}
+
+LatencyTracer::Report LatencyTracer::report() const {
+  pthread::MutexLock m(lock_);
+  return report_;
+}
+
+void LatencyTracer::Add(Histogram* histogram, int64_t latency_us) {
+  const uint64_t latency = std::max(latency_us, int64_t{0});
+  int bucket = 0;
+  for (uint64_t ms = latency / 1000; ms > 0 && bucket < kBuckets - 1;
+       ms >>= 1) {
+    ++bucket;
+  }
+  ++histogram->counts[bucket];
+  ++histogram->samples;
+  histogram->total_us += latency;
+  histogram->max_us = std::max(histogram->max_us, latency);
+}
@@ -0,0 +1,97 @@
+// latency_tracer.h - Measures keystroke-to-display latency.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MOSH_NACL_LATENCY_TRACER_H_
+#define MOSH_NACL_LATENCY_TRACER_H_
+
+#include <stdint.h>
+#include <deque>
+
+#include "mosh_nacl/pthread_locks.h"
+
+// LatencyTracer follows keystrokes from JavaScript, through Mosh and the
+// network, to the display output that follows them, and keeps a histogram of
+// the time from input to each stage. This is the latency users feel when
+// typing.
+//
+// Call Mark() at each stage. A stage applies to every keystroke waiting for
+// it, so a batch of keystrokes read together is sent, echoed, and displayed
+// together. Keystrokes that don't reach the display within kMaxAge
+// microseconds (such as those of a password, which are never echoed) are
+// abandoned. Can be called from any thread.
+class LatencyTracer {
+ public:
+  enum Stage {
+    INPUT = 0,  // Arrived from JavaScript.
+    READ,       // Read by Mosh.
+    SEND,       // First datagram sent afterwards.
+    RECEIVE,    // First datagram received afterwards.
+    DISPLAY,    // First display output afterwards.
+    NUM_STAGES,
+  };
+
+  // Bucket i counts latencies under 2^i ms, and at least 2^(i-1) ms; the last
+  // bucket also counts anything longer.
+  static const int kBuckets = 13;
+  static const int64_t kMaxAge = 5 * 1000000;
+
+  struct Histogram {
+    uint64_t counts[kBuckets] = {};
+    uint64_t samples = 0;
+    uint64_t total_us = 0;
+    uint64_t max_us = 0;
+  };
+
+  struct Report {
+    // Time from INPUT to each stage, for keystrokes that reached DISPLAY.
+    // stages[INPUT] is always empty.
+    Histogram stages[NUM_STAGES];
+    uint64_t completed = 0;
+    uint64_t abandoned = 0;
+  };
+
+  LatencyTracer() = default;
+  LatencyTracer(const LatencyTracer&) = delete;
+  LatencyTracer& operator=(const LatencyTracer&) = delete;
+  ~LatencyTracer() = default;
+
+  // Records that |stage| happened now.
+  void Mark(Stage stage);
+
+  // Records that |stage| happened at |now_us|, on a monotonic clock.
+  void MarkAt(Stage stage, int64_t now_us);
+
+  Report report() const;
+
+ private:
+  struct Trace {
+    int64_t times[NUM_STAGES];
+    Stage reached;
+  };
+
+  // Bound on keystrokes in flight, in case of a paste.
+  static const size_t kMaxPending = 256;
+
+  static void Add(Histogram* histogram, int64_t latency_us);
+
+  // Guard these with lock_.
+  std::deque<Trace> pending_;
+  Report report_;
+  mutable pthread::Mutex lock_;
+};
+
+#endif  // MOSH_NACL_LATENCY_TRACER_H_
@@ -0,0 +1,105 @@
+// latency_tracer_test.cc - Tests for latency_tracer.{h,cc}.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/latency_tracer.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Drives one keystroke through every stage, |step_us| apart, from |start_us|.
+void Keystroke(LatencyTracer* tracer, int64_t start_us, int64_t step_us) {
+  for (int s = LatencyTracer::INPUT; s < LatencyTracer::NUM_STAGES; ++s) {
+    tracer->MarkAt(static_cast<LatencyTracer::Stage>(s),
+                   start_us + s * step_us);
+  }
+}
+
+}  // anonymous namespace
+
+TEST(LatencyTracerTest, OneKeystroke) {
+  LatencyTracer tracer;
+  Keystroke(&tracer, 1000000, 3000);
+  const auto report = tracer.report();
+  EXPECT_EQ(1, report.completed);
+  EXPECT_EQ(0, report.abandoned);
+  EXPECT_EQ(0, report.stages[LatencyTracer::INPUT].samples);
+  // 3 ms, 6 ms, 9 ms, 12 ms.
+  EXPECT_EQ(1, report.stages[LatencyTracer::READ].counts[2]);
+  EXPECT_EQ(1, report.stages[LatencyTracer::SEND].counts[3]);
+  EXPECT_EQ(1, report.stages[LatencyTracer::RECEIVE].counts[4]);
+  EXPECT_EQ(1, report.stages[LatencyTracer::DISPLAY].counts[4]);
+  EXPECT_EQ(12000, report.stages[LatencyTracer::DISPLAY].total_us);
+  EXPECT_EQ(12000, report.stages[LatencyTracer::DISPLAY].max_us);
+}
+
+TEST(LatencyTracerTest, StagesNeedTheirPredecessor) {
+  LatencyTracer tracer;
+  // Output without input doesn't count.
+  tracer.MarkAt(LatencyTracer::DISPLAY, 0);
+  tracer.MarkAt(LatencyTracer::INPUT, 1000);
+  // Display output before the keystroke was even sent doesn't count either.
+  tracer.MarkAt(LatencyTracer::READ, 2000);
+  tracer.MarkAt(LatencyTracer::DISPLAY, 3000);
+  EXPECT_EQ(0, tracer.report().completed);
+  tracer.MarkAt(LatencyTracer::SEND, 4000);
+  tracer.MarkAt(LatencyTracer::RECEIVE, 5000);
+  tracer.MarkAt(LatencyTracer::DISPLAY, 6000);
+  EXPECT_EQ(1, tracer.report().completed);
+  EXPECT_EQ(5000, tracer.report().stages[LatencyTracer::DISPLAY].total_us);
+}
+
+TEST(LatencyTracerTest, BatchedKeystrokes) {
+  LatencyTracer tracer;
+  tracer.MarkAt(LatencyTracer::INPUT, 0);
+  tracer.MarkAt(LatencyTracer::INPUT, 1000);
+  tracer.MarkAt(LatencyTracer::READ, 2000);
+  // A third keystroke misses the first datagram.
+  tracer.MarkAt(LatencyTracer::INPUT, 3000);
+  for (int s = LatencyTracer::SEND; s < LatencyTracer::NUM_STAGES; ++s) {
+    tracer.MarkAt(static_cast<LatencyTracer::Stage>(s), 4000 + s);
+  }
+  auto report = tracer.report();
+  EXPECT_EQ(2, report.completed);
+  EXPECT_EQ(2, report.stages[LatencyTracer::DISPLAY].samples);
+  EXPECT_EQ(4004 + 3004, report.stages[LatencyTracer::DISPLAY].total_us);
+
+  // The third goes with the next keystroke.
+  Keystroke(&tracer, 10000, 1);
+  report = tracer.report();
+  EXPECT_EQ(4, report.completed);
+}
+
+TEST(LatencyTracerTest, Abandoned) {
+  LatencyTracer tracer;
+  // Like a password: read and sent, but never echoed.
+  tracer.MarkAt(LatencyTracer::INPUT, 0);
+  tracer.MarkAt(LatencyTracer::READ, 1000);
+  tracer.MarkAt(LatencyTracer::SEND, 2000);
+  Keystroke(&tracer, LatencyTracer::kMaxAge + 1, 1000);
+  const auto report = tracer.report();
+  EXPECT_EQ(1, report.abandoned);
+  EXPECT_EQ(1, report.completed);
+  EXPECT_EQ(4000, report.stages[LatencyTracer::DISPLAY].max_us);
+}
+
+TEST(LatencyTracerTest, LongLatencyInLastBucket) {
+  LatencyTracer tracer;
+  Keystroke(&tracer, 0, 1000000);
+  const auto& display = tracer.report().stages[LatencyTracer::DISPLAY];
+  EXPECT_EQ(1, display.counts[LatencyTracer::kBuckets - 1]);
+}
@@ -0,0 +1,418 @@
+// logger.cc - Rate-limited in-memory log.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/logger.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <algorithm>
+
+using std::string;
+using std::vector;
+
+const size_t Logger::kCapacity;
+const int Logger::kBurst;
+const int64_t Logger::kRefill;
+const int Logger::kMaxArgs;
+const size_t Logger::kTextSize;
+
+namespace {
+
+enum Length { NONE, HH, H, L, LL, Z, J, T, LONG_DOUBLE };
+
+// One printf() conversion directive, such as "%-8.3lld".
+struct Directive {
+  size_t prefix_size;  // The '%', flags, width, and precision.
+  Length length;
+  char conversion;
+  bool star;  // Whether the width or precision is an argument.
+};
+
+// Parses the directive starting with the '%' at |start|, and returns where the
+// rest of the format string starts.
+const char* ParseDirective(const char* start, Directive* d) {
+  const char* p = start + 1;
+  while (*p != '\0' && strchr("-+ #0'", *p) != nullptr) {
+    ++p;
+  }
+  d->star = false;
+  while ((*p >= '0' && *p <= '9') || *p == '.' || *p == '*') {
+    d->star = d->star || *p == '*';
+    ++p;
+  }
+  d->prefix_size = p - start;
+
+  d->length = NONE;
+  switch (*p) {
+    case 'h':
+      ++p;
+      if (*p == 'h') {
+        d->length = HH;
+        ++p;
+      } else {
+        d->length = H;
+      }
+      break;
+    case 'l':
+      ++p;
+      if (*p == 'l') {
+        d->length = LL;
+        ++p;
+      } else {
+        d->length = L;
+      }
+      break;
+    case 'z':
+      d->length = Z;
+      ++p;
+      break;
+    case 'j':
+      d->length = J;
+      ++p;
+      break;
+    case 't':
+      d->length = T;
+      ++p;
+      break;
+    case 'L':
+      d->length = LONG_DOUBLE;
+      ++p;
+      break;
+  }
+  d->conversion = *p;
+  return *p == '\0' ? p : p + 1;
+}
+
+// Appends |value| formatted with |spec| to |out|.
+template <typename T>
+void AppendFormatted(string* out, const string& spec, T value) {
+  char buf[64];
+  const int size = snprintf(buf, sizeof(buf), spec.c_str(), value);
+  if (size < 0) {
+    return;
+  }
+  if (static_cast<size_t>(size) < sizeof(buf)) {
+    out->append(buf, size);
+    return;
+  }
+  const size_t old_size = out->size();
+  out->resize(old_size + size + 1);
+  snprintf(&(*out)[old_size], size + 1, spec.c_str(), value);
+  out->resize(old_size + size);
+}
+
+}  // namespace
+
+Logger::Logger() : ring_(kCapacity) {}
+
+void Logger::Log(Severity severity, const char* format, ...) {
+  va_list argp;
+  va_start(argp, format);
+  Logv(severity, format, argp);
+  va_end(argp);
+}
+
+void Logger::Logv(Severity severity, const char* format, va_list argp) {
+  const int64_t now = Now();
+  pthread::MutexLock m(lock_);
+
+  auto it = sites_.find(format);
+  if (it == sites_.end()) {
+    it = sites_.insert({format, Site{kBurst, now, 0}}).first;
+  }
+  Site& site = it->second;
+  const int64_t refills = (now - site.refilled) / kRefill;
+  if (refills > 0) {
+    site.tokens = std::min<int64_t>(kBurst, site.tokens + refills * kBurst);
+    site.refilled += refills * kRefill;
+  }
+  if (severity != ERROR) {
+    if (site.tokens == 0) {
+      ++site.suppressed;
+      ++stats_.suppressed;
+      return;
+    }
+    --site.tokens;
+  }
+
+  if (size_ == kCapacity) {
+    head_ = (head_ + 1) % kCapacity;
+    --size_;
+    ++overwritten_since_drain_;
+    ++stats_.overwritten;
+  }
+  Record& record = ring_[(head_ + size_) % kCapacity];
+  ++size_;
+  ++stats_.recorded;
+  record.time = now;
+  record.severity = severity;
+  record.format = format;
+  record.suppressed = site.suppressed;
+  site.suppressed = 0;
+
+  va_list args;
+  va_copy(args, argp);
+  const bool captured = Capture(format, args, &record);
+  va_end(args);
+  if (!captured) {
+    record.format = nullptr;
+    vsnprintf(record.text, sizeof(record.text), format, argp);
+  }
+}
+
+string Logger::Drain() {
+  vector<Record> records;
+  uint64_t overwritten;
+  {
+    pthread::MutexLock m(lock_);
+    records.reserve(size_);
+    for (size_t i = 0; i < size_; ++i) {
+      records.push_back(ring_[(head_ + i) % kCapacity]);
+    }
+    head_ = 0;
+    size_ = 0;
+    overwritten = overwritten_since_drain_;
+    overwritten_since_drain_ = 0;
+  }
+
+  string out;
+  if (overwritten > 0) {
+    AppendFormatted(&out, "[%llu earlier records were overwritten]\n",
+                    static_cast<unsigned long long>(overwritten));  // NOLINT
+  }
+  for (const auto& record : records) {
+    AppendFormatted(&out, "[%.3f] ", record.time / 1e6);
+    out.append(record.severity == ERROR ? "E " : "I ");
+    Format(record, &out);
+    if (record.suppressed > 0) {
+      AppendFormatted(&out, " [%u similar records suppressed]",
+                      record.suppressed);
+    }
+    out.push_back('\n');
+  }
+  return out;
+}
+
+Logger::Stats Logger::stats() const {
+  pthread::MutexLock m(lock_);
+  return stats_;
+}
+
+int64_t Logger::Now() const {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+bool Logger::Capture(const char* format, va_list argp, Record* record) {
+  int num_args = 0;
+  size_t text_used = 0;
+  for (const char* p = format; *p != '\0';) {
+    if (*p != '%') {
+      ++p;
+      continue;
+    }
+    if (p[1] == '%') {
+      p += 2;
+      continue;
+    }
+    Directive d;
+    p = ParseDirective(p, &d);
+    if (d.star || num_args == kMaxArgs) {
+      return false;
+    }
+    Record::Arg& arg = record->args[num_args++];
+
+    switch (d.conversion) {
+      case 'd':
+      case 'i':
+        switch (d.length) {
+          case HH:
+            arg.i = static_cast<signed char>(va_arg(argp, int));
+            break;
+          case H:
+            arg.i = static_cast<short>(va_arg(argp, int));  // NOLINT
+            break;
+          case NONE:
+            arg.i = va_arg(argp, int);
+            break;
+          case L:
+            arg.i = va_arg(argp, long);  // NOLINT(runtime/int)
+            break;
+          case LL:
+            arg.i = va_arg(argp, long long);  // NOLINT(runtime/int)
+            break;
+          case Z:
+            arg.i = va_arg(argp, ssize_t);
+            break;
+          case J:
+            arg.i = va_arg(argp, intmax_t);
+            break;
+          case T:
+            arg.i = va_arg(argp, ptrdiff_t);
+            break;
+          default:
+            return false;
+        }
+        break;
+
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        switch (d.length) {
+          case HH:
+            arg.u = static_cast<unsigned char>(va_arg(argp, unsigned int));
+            break;
+          case H:
+            arg.u = static_cast<unsigned short>(  // NOLINT(runtime/int)
+                va_arg(argp, unsigned int));
+            break;
+          case NONE:
+            arg.u = va_arg(argp, unsigned int);
+            break;
+          case L:
+            arg.u = va_arg(argp, unsigned long);  // NOLINT(runtime/int)
+            break;
+          case LL:
+            arg.u = va_arg(argp, unsigned long long);  // NOLINT(runtime/int)
+            break;
+          case Z:
+            arg.u = va_arg(argp, size_t);
+            break;
+          case J:
+            arg.u = va_arg(argp, uintmax_t);
+            break;
+          case T:
+            arg.u = va_arg(argp, ptrdiff_t);
+            break;
+          default:
+            return false;
+        }
+        break;
+
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'F':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        if (d.length != NONE && d.length != L) {
+          return false;
+        }
+        arg.d = va_arg(argp, double);
+        break;
+
+      case 'c':
+        if (d.length != NONE) {
+          return false;
+        }
+        arg.i = va_arg(argp, int);
+        break;
+
+      case 'p':
+        arg.p = va_arg(argp, void*);
+        break;
+
+      case 's': {
+        if (d.length != NONE) {
+          return false;
+        }
+        const char* s = va_arg(argp, const char*);
+        if (s == nullptr) {
+          s = "(null)";
+        }
+        // Strings that don't fit are truncated; text[kTextSize - 1] is always
+        // a terminator once the space is used up.
+        if (text_used >= kTextSize) {
+          arg.offset = kTextSize - 1;
+          break;
+        }
+        const size_t size = strnlen(s, kTextSize - 1 - text_used);
+        memcpy(record->text + text_used, s, size);
+        record->text[text_used + size] = '\0';
+        arg.offset = text_used;
+        text_used += size + 1;
+        break;
+      }
+
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+void Logger::Format(const Record& record, string* out) {
+  if (record.format == nullptr) {
+    out->append(record.text);
+    return;
+  }
+
+  int num_args = 0;
+  for (const char* p = record.format; *p != '\0';) {
+    if (*p != '%') {
+      const char* end = strchr(p, '%');
+      if (end == nullptr) {
+        end = p + strlen(p);
+      }
+      out->append(p, end - p);
+      p = end;
+      continue;
+    }
+    if (p[1] == '%') {
+      out->push_back('%');
+      p += 2;
+      continue;
+    }
+    Directive d;
+    const char* start = p;
+    p = ParseDirective(p, &d);
+    const Record::Arg& arg = record.args[num_args++];
+    // Integers were widened when captured, so their length modifiers become
+    // "ll".
+    string spec(start, d.prefix_size);
+    switch (d.conversion) {
+      case 'd':
+      case 'i':
+        AppendFormatted(out, spec + "ll" + d.conversion, arg.i);
+        break;
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        AppendFormatted(out, spec + "ll" + d.conversion, arg.u);
+        break;
+      case 'c':
+        AppendFormatted(out, spec + d.conversion, static_cast<int>(arg.i));
+        break;
+      case 'p':
+        AppendFormatted(out, spec + d.conversion, arg.p);
+        break;
+      case 's':
+        AppendFormatted(out, spec + d.conversion, record.text + arg.offset);
+        break;
+      default:
+        AppendFormatted(out, spec + d.conversion, arg.d);
+        break;
+    }
+  }
+}
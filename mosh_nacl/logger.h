@@ -0,0 +1,123 @@
+// logger.h - Rate-limited in-memory log.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MOSH_NACL_LOGGER_H_
+#define MOSH_NACL_LOGGER_H_
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mosh_nacl/pthread_locks.h"
+
+// Logger keeps the most recent log records in a fixed-size ring, to be
+// written out with Drain() when someone wants them.
+//
+// Records are kept in binary: the format string and the arguments it consumes,
+// with only strings copied. Formatting waits for Drain(), so that logging is
+// cheap and the bulk of it, which is never read, is never formatted. Directives
+// that can't be captured this way (such as "%*d") are formatted at once.
+//
+// Each format string is taken to be a call site, and may log kBurst records,
+// and kBurst more for every kRefill microseconds after. Records beyond that are
+// counted, and the count is reported with the site's next record. ERROR records
+// are never dropped. Can be called from any thread.
+class Logger {
+ public:
+  enum Severity {
+    INFO = 0,
+    ERROR,
+  };
+
+  static const size_t kCapacity = 512;
+  static const int kBurst = 10;
+  static const int64_t kRefill = 1000000;
+
+  struct Stats {
+    uint64_t recorded = 0;
+    uint64_t suppressed = 0;   // Dropped by rate limiting.
+    uint64_t overwritten = 0;  // Dropped from the ring before a Drain().
+  };
+
+  Logger();
+  Logger(const Logger&) = delete;
+  Logger& operator=(const Logger&) = delete;
+  virtual ~Logger() = default;
+
+  // Records a message. |format| is kept until Drain(), so it must be a string
+  // literal.
+  void Log(Severity severity, const char* format, ...);
+  void Logv(Severity severity, const char* format, va_list argp);
+
+  // Formats the records, oldest first and one per line, and empties the ring.
+  std::string Drain();
+
+  Stats stats() const;
+
+ protected:
+  // Returns the time in microseconds, on a monotonic clock. Virtual for
+  // testing.
+  virtual int64_t Now() const;
+
+ private:
+  static const int kMaxArgs = 8;
+  // Room for the strings of a record's arguments, or its formatted text.
+  static const size_t kTextSize = 160;
+
+  struct Record {
+    int64_t time;
+    Severity severity;
+    // nullptr if |text| was formatted when logged.
+    const char* format;
+    uint32_t suppressed;  // Records of this site dropped just before.
+    union Arg {
+      long long i;           // NOLINT(runtime/int)
+      unsigned long long u;  // NOLINT(runtime/int)
+      double d;
+      const void* p;
+      size_t offset;  // Of a string, in |text|.
+    } args[kMaxArgs];
+    char text[kTextSize];
+  };
+
+  struct Site {
+    int64_t tokens;
+    int64_t refilled;  // When |tokens| was last topped up.
+    uint32_t suppressed;
+  };
+
+  // Fills |record| with the arguments |format| consumes from |argp|. Returns
+  // false if |format| has a directive it can't capture.
+  static bool Capture(const char* format, va_list argp, Record* record);
+
+  // Appends |record|'s message to |out|.
+  static void Format(const Record& record, std::string* out);
+
+  // Guard these with lock_.
+  std::vector<Record> ring_;
+  size_t head_ = 0;  // The oldest record.
+  size_t size_ = 0;
+  uint64_t overwritten_since_drain_ = 0;
+  std::unordered_map<const char*, Site> sites_;
+  Stats stats_;
+  mutable pthread::Mutex lock_;
+};
+
+#endif  // MOSH_NACL_LOGGER_H_
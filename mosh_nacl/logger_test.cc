@@ -0,0 +1,128 @@
+// logger_test.cc - Tests for the rate-limited in-memory log.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/logger.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include "gtest/gtest.h"
+
+using std::string;
+
+namespace {
+
+// Uses a clock the test controls.
+class TestLogger : public Logger {
+ public:
+  int64_t now = 0;
+
+ protected:
+  int64_t Now() const override { return now; }
+};
+
+// Drains |logger| and strips the timestamps.
+string Messages(Logger* logger) {
+  const string log = logger->Drain();
+  string messages;
+  for (size_t start = 0; start < log.size();) {
+    const size_t end = log.find('\n', start) + 1;
+    const size_t message = log.find("] ", start) + 2;
+    messages += log.substr(message, end - message);
+    start = end;
+  }
+  return messages;
+}
+
+}  // anonymous namespace
+
+TEST(LoggerTest, FormatsWhenDrained) {
+  TestLogger logger;
+  logger.now = 1500000;
+  logger.Log(Logger::INFO, "int %d, long %ld, unsigned %04x, char %c", -3,
+             123456789L, 0xabu, 'z');
+  logger.Log(Logger::ERROR, "%s: %.2f%% done, %zu left, %lld total", "copy",
+             99.5, static_cast<size_t>(7), -9000000000LL);
+  EXPECT_EQ(
+      "[1.500] I int -3, long 123456789, unsigned 00ab, char z\n"
+      "[1.500] E copy: 99.50% done, 7 left, -9000000000 total\n",
+      logger.Drain());
+  EXPECT_EQ("", logger.Drain());
+}
+
+TEST(LoggerTest, ShortIntegersKeepTheirWidth) {
+  TestLogger logger;
+  logger.Log(Logger::INFO, "%hx %hhu %hd", -1, 257, 65535);
+  EXPECT_EQ("I ffff 1 -1\n", Messages(&logger));
+}
+
+TEST(LoggerTest, CopiesStrings) {
+  TestLogger logger;
+  char buf[] = "before";
+  logger.Log(Logger::INFO, "%s and %-8s|%s", buf, "after", nullptr);
+  strcpy(buf, "later");  // NOLINT(runtime/printf)
+  EXPECT_EQ("I before and after   |(null)\n", Messages(&logger));
+}
+
+TEST(LoggerTest, TruncatesLongStrings) {
+  TestLogger logger;
+  const string long_string(1000, 'x');
+  logger.Log(Logger::INFO, "%s|%s", long_string.c_str(), "gone");
+  const string message = Messages(&logger);
+  EXPECT_LT(message.size(), 200);
+  EXPECT_EQ("I xxxx", message.substr(0, 6));
+  EXPECT_EQ("|\n", message.substr(message.size() - 2));
+}
+
+TEST(LoggerTest, FormatsUnsupportedDirectivesAtOnce) {
+  TestLogger logger;
+  logger.Log(Logger::INFO, "%*d|%Lf", 5, 42, 1.5L);
+  EXPECT_EQ("I    42|1.500000\n", Messages(&logger));
+}
+
+TEST(LoggerTest, RateLimitsEachSite) {
+  TestLogger logger;
+  for (int i = 0; i < Logger::kBurst + 5; ++i) {
+    logger.Log(Logger::INFO, "chatty %d", i);
+    logger.Log(Logger::INFO, "quiet");
+  }
+  const Logger::Stats stats = logger.stats();
+  EXPECT_EQ(10, stats.suppressed);
+  EXPECT_EQ(2 * Logger::kBurst, stats.recorded);
+
+  // Errors get through anyway.
+  logger.Log(Logger::ERROR, "chatty %d", 100);
+  logger.now += Logger::kRefill;
+  logger.Log(Logger::INFO, "chatty %d", 101);
+  const string messages = Messages(&logger);
+  EXPECT_NE(string::npos, messages.find("E chatty 100 [5 similar records "
+                                        "suppressed]\nI chatty 101\n"));
+  EXPECT_EQ(string::npos, messages.find("chatty 10\n"));
+}
+
+TEST(LoggerTest, OverwritesOldestRecords) {
+  TestLogger logger;
+  for (size_t i = 0; i < Logger::kCapacity + 3; ++i) {
+    logger.Log(Logger::ERROR, "record %zu", i);
+  }
+  EXPECT_EQ(3, logger.stats().overwritten);
+  const string log = logger.Drain();
+  EXPECT_EQ(0, log.find("[3 earlier records were overwritten]\n"
+                        "[0.000] E record 3\n"));
+  EXPECT_NE(string::npos, log.find("record 514\n"));
+}
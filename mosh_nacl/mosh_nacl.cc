@@ -35,17 +35,20 @@
 #include <utility>
 #include <vector>
 
+#include "mosh_nacl/caching_resolver.h"
 #include "mosh_nacl/gpdns_resolver.h"
 #include "mosh_nacl/make_unique.h"
+#include "mosh_nacl/pepper_posix_impaired_udp.h"
+#include "mosh_nacl/pepper_posix_native_udp.h"
 #include "mosh_nacl/pepper_posix_tcp.h"
 #include "mosh_nacl/pepper_resolver.h"
 #include "mosh_nacl/pthread_locks.h"
+#include "mosh_nacl/utf8_splitter.h"
 
 #include "irt.h"  // NOLINT(build/include)
 #include "ppapi/cpp/module.h"
+#include "ppapi/cpp/var_array_buffer.h"
 
-using std::back_inserter;
-using std::copy;
 using std::deque;
 using std::function;
 using std::map;
@@ -57,6 +60,13 @@ using util::make_unique;
 // Forward declaration of mosh_main(), as it has no header file.
 int mosh_main(int argc, char* argv[]);
 
+// How long name lookups are reused. Resolvers don't report TTLs, and a
+// session only needs its names for a short while at startup.
+const int kDNSCacheSeconds = 300;
+
+// Bound on the size of an I/O trace, which is kept in memory.
+const size_t kIOTraceMaxSize = 64 * 1024 * 1024;
+
 // Used by pepper_wrapper.h functions.
 static class MoshClientInstance* instance = nullptr;
 
@@ -70,8 +80,6 @@ class Keyboard : public PepperPOSIX::Reader {
   ssize_t Read(void* buf, size_t count) override {
     int num_read = 0;
 
-    pthread::MutexLock m(keypresses_lock_);
-
     while (keypresses_.size() > 0 && num_read < count) {
       reinterpret_cast<unsigned char*>(buf)[num_read] = keypresses_.front();
       keypresses_.pop_front();
@@ -79,6 +87,9 @@ class Keyboard : public PepperPOSIX::Reader {
     }
 
     target_->UpdateRead(keypresses_.size() > 0);
+    if (num_read > 0 && latency_tracer_ != nullptr) {
+      latency_tracer_->Mark(LatencyTracer::READ);
+    }
 
     return num_read;
   }
@@ -89,22 +100,42 @@ class Keyboard : public PepperPOSIX::Reader {
       // Nothing to see here.
       return;
     }
-    {
-      pthread::MutexLock m(keypresses_lock_);
-      for (int i = 0; i < input.GetLength(); ++i) {
-        keypresses_.push_back(input.Get(i).AsInt());
-      }
+    PepperPOSIX::Event event;
+    event.data.reserve(input.GetLength());
+    for (int i = 0; i < input.GetLength(); ++i) {
+      event.data.push_back(input.Get(i).AsInt());
+    }
+    if (latency_tracer_ != nullptr) {
+      latency_tracer_->Mark(LatencyTracer::INPUT);
     }
+    PostEvent(move(event));
+  }
+
+  // Set the tracer to tell of keystrokes, or nullptr. Does not take
+  // ownership.
+  void set_latency_tracer(LatencyTracer* tracer) { latency_tracer_ = tracer; }
+
+ protected:
+  void HandleEvent(PepperPOSIX::Event event) override {
+    keypresses_.insert(keypresses_.end(), event.data.begin(),
+                       event.data.end());
     target_->UpdateRead(true);
   }
 
  private:
   // Queue of keyboard keypresses.
-  deque<unsigned char> keypresses_;  // Guard with keypresses_lock_.
-  pthread::Mutex keypresses_lock_;
+  deque<unsigned char> keypresses_;
+  LatencyTracer* latency_tracer_ = nullptr;
 };
 
-// Implements the plumbing to get stdout to the terminal.
+// Implements the plumbing to get stdout to the terminal. A tiny amount of
+// plumbing is in MoshClientInstance::HandleMessage().
+//
+// Output is flow controlled: JavaScript acknowledges display messages once
+// they have been rendered, and the Terminal stops being writable while more
+// than kDisplayWindow_ bytes are unacknowledged. This keeps messages from
+// piling up in the browser when hterm falls behind; Mosh blocks instead, and
+// then draws only the latest state rather than every intermediate frame.
 class Terminal : public PepperPOSIX::Writer {
  public:
   explicit Terminal(MoshClientInstance& instance) : instance_(instance) {}
@@ -113,8 +144,26 @@ class Terminal : public PepperPOSIX::Writer {
   // This has to be defined below MoshClientInstance due to dependence on it.
   ssize_t Write(const void* buf, size_t count) override;
 
+  // Handle acknowledgement that |count| display messages were rendered.
+  void HandleAck(int count) {
+    pthread::MutexLock m(unacked_lock_);
+    for (; count > 0 && unacked_sizes_.size() > 0; --count) {
+      unacked_bytes_ -= unacked_sizes_.front();
+      unacked_sizes_.pop_front();
+    }
+    target_->UpdateWrite(unacked_bytes_ < kDisplayWindow_);
+  }
+
  private:
+  static const size_t kDisplayWindow_ = 64 * 1024;
+
   MoshClientInstance& instance_;
+  // Keeps each message to JavaScript whole, valid UTF-8.
+  UTF8Splitter utf8_splitter_;
+  // Sizes of display messages not yet acknowledged, oldest first.
+  deque<size_t> unacked_sizes_;  // Guard with unacked_lock_.
+  size_t unacked_bytes_ = 0;     // Guard with unacked_lock_.
+  pthread::Mutex unacked_lock_;
 };
 
 // Implements the plumbing to get stderr to Javascript.
@@ -183,7 +232,8 @@ class DevURandom : public PepperPOSIX::Reader {
   struct nacl_irt_random random_;
 };
 
-// Packetizer for SSH agent communications.
+// Packetizer for SSH agent communications. Data is kept in one contiguous
+// buffer, and packets are parsed and copied out of it in place.
 class SSHAgentPacketizer {
  public:
   SSHAgentPacketizer() = default;
@@ -191,44 +241,55 @@ class SSHAgentPacketizer {
   SSHAgentPacketizer& operator=(const SSHAgentPacketizer&) = delete;
 
   // Add data to the packetizer buffer.
-  void AddData(string data) {
-    copy(data.begin(), data.end(), back_inserter(buf_));
+  void AddData(const void* data, size_t count) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    buf_.insert(buf_.end(), bytes, bytes + count);
   }
 
   // Checks to see if ConsumePacket() will return a full packet.
   bool IsPacketAvailable() const {
-    return buf_.size() >= GetSize() + kHeaderSize_;
+    return buf_.size() - start_ >= kHeaderSize_ &&
+           buf_.size() - start_ - kHeaderSize_ >= GetSize();
   }
 
-  // Returns one full packet, or an empty vector if one is not available.
-  pp::VarArray ConsumePacket() {
-    pp::VarArray result;
-
+  // Returns one full packet (without the size header), or an empty buffer if
+  // one is not available.
+  pp::VarArrayBuffer ConsumePacket() {
     if (!IsPacketAvailable()) {
-      return result;  // Empty string (RVO).
+      return pp::VarArrayBuffer(0);
     }
 
     const auto size = GetSize();
-    for (int i = 0; i < size; ++i) {
-      result.Set(i, pp::Var(buf_.at(i + kHeaderSize_)));
+    pp::VarArrayBuffer result(size);
+    memcpy(result.Map(), buf_.data() + start_ + kHeaderSize_, size);
+    result.Unmap();
+    start_ += kHeaderSize_ + size;
+
+    // Reclaim consumed space once it is all used up, or is the bulk of the
+    // buffer, so that it doesn't grow without bound.
+    if (start_ == buf_.size()) {
+      buf_.clear();
+      start_ = 0;
+    } else if (start_ > buf_.size() / 2) {
+      buf_.erase(buf_.begin(), buf_.begin() + start_);
+      start_ = 0;
     }
-    buf_.erase(buf_.begin(), buf_.begin() + kHeaderSize_ + size);
     return result;
   }
 
-  // Generate a packet with size header from a pp::VarArray.
-  static vector<uint8_t> PacketFromArray(const pp::VarArray& data) {
-    vector<uint8_t> v_data;
-    uint32_t size = data.GetLength();
-    v_data.reserve(size + kHeaderSize_);
+  // Generate a packet with size header from a pp::VarArrayBuffer.
+  static vector<uint8_t> PacketFromArrayBuffer(pp::VarArrayBuffer data) {
+    const uint32_t size = data.ByteLength();
+    vector<uint8_t> v_data(size + kHeaderSize_);
 
-    v_data.push_back((size >> 24) & 0xff);
-    v_data.push_back((size >> 16) & 0xff);
-    v_data.push_back((size >> 8) & 0xff);
-    v_data.push_back(size & 0xff);
+    v_data[0] = (size >> 24) & 0xff;
+    v_data[1] = (size >> 16) & 0xff;
+    v_data[2] = (size >> 8) & 0xff;
+    v_data[3] = size & 0xff;
 
-    for (int i = 0; i < size; ++i) {
-      v_data.push_back(static_cast<uint8_t>(data.Get(i).AsInt()));
+    if (size > 0) {
+      memcpy(v_data.data() + kHeaderSize_, data.Map(), size);
+      data.Unmap();
     }
     return v_data;
   }
@@ -237,18 +298,21 @@ class SSHAgentPacketizer {
   // Get the size header value from the buffered packet. Returns zero if the
   // buffer does not contain enough data for the size header.
   uint32_t GetSize() const {
-    if (buf_.size() < kHeaderSize_) {
+    if (buf_.size() - start_ < kHeaderSize_) {
       return 0;
     }
 
-    return (static_cast<uint32_t>(buf_[0]) << 24) +
-           (static_cast<uint32_t>(buf_[1]) << 16) +
-           (static_cast<uint32_t>(buf_[2]) << 8) +
-           (static_cast<uint32_t>(buf_[3]));
+    const uint8_t* header = buf_.data() + start_;
+    return (static_cast<uint32_t>(header[0]) << 24) +
+           (static_cast<uint32_t>(header[1]) << 16) +
+           (static_cast<uint32_t>(header[2]) << 8) +
+           (static_cast<uint32_t>(header[3]));
   }
 
-  static const int kHeaderSize_ = 4;
-  deque<uint8_t> buf_;
+  static const size_t kHeaderSize_ = 4;
+  vector<uint8_t> buf_;
+  // Offset of the first unconsumed byte in |buf_|.
+  size_t start_ = 0;
 };
 
 // Implements virtual Unix domain sockets, which is used to connect libssh to
@@ -274,9 +338,9 @@ class UnixSocketStreamImpl : public PepperPOSIX::UnixSocketStream {
         return -1;
 
       case FileType::SSH_AUTH_SOCK: {
-        const char* bytes = static_cast<const char*>(buf);
-        agent_packetizer_.AddData(string(bytes, count));
-        if (agent_packetizer_.IsPacketAvailable()) {
+        agent_packetizer_.AddData(buf, count);
+        // libssh may write several requests, or a partial one, at a time.
+        while (agent_packetizer_.IsPacketAvailable()) {
           auto packet = agent_packetizer_.ConsumePacket();
           instance_->Output(MoshClientInstance::TYPE_SSH_AGENT, packet);
         }
@@ -320,8 +384,8 @@ class UnixSocketStreamImpl : public PepperPOSIX::UnixSocketStream {
     return -1;
   }
 
-  void HandleInput(const pp::VarArray& data) {
-    vector<uint8_t> v_data = SSHAgentPacketizer::PacketFromArray(data);
+  void HandleInput(const pp::VarArrayBuffer& data) {
+    vector<uint8_t> v_data = SSHAgentPacketizer::PacketFromArrayBuffer(data);
     AddData(v_data.data(), v_data.size());
   }
 
@@ -366,28 +430,38 @@ void MoshClientInstance::HandleMessage(const pp::Var& var) {
 
   if (dict.HasKey("keyboard")) {
     keyboard_->HandleInput(pp::VarArray(dict.Get("keyboard")));
+  } else if (dict.HasKey("display_ack")) {
+    terminal_->HandleAck(dict.Get("display_ack").AsInt());
   } else if (dict.HasKey("window_change")) {
     int32_t num = dict.Get("window_change").AsInt();
+    if (io_trace_ != nullptr) {
+      io_trace_->AddWindowChange(num >> 16, num & 0xffff);
+    }
     window_change_->Update(num >> 16, num & 0xffff);
   } else if (dict.HasKey("ssh_key")) {
     pp::Var key = dict.Get("ssh_key");
     if (key.is_undefined() == false) {
       ssh_login_.set_key(key.AsString());
     }
-    // Now get the known hosts.
-    Output(TYPE_GET_KNOWN_HOSTS, "");
-  } else if (dict.HasKey("known_hosts")) {
-    pp::Var known_hosts = dict.Get("known_hosts");
-    if (known_hosts.is_undefined() == false) {
-      ssh_login_.set_known_hosts(known_hosts);
-    }
     // The assumption is that Output(TYPE_GET_SSH_KEY, "") was already
-    // called, which precipitated Output(TYPE_GET_KNOWN_HOSTS, ""), so now we
-    // are ready to do the SSH login.
+    // called, so now we are ready to do the SSH login.
     LaunchSSHLogin();
+  } else if (dict.HasKey("known_hosts")) {
+    pthread::MutexLock m(known_hosts_lock_);
+    if (known_hosts_pending_) {
+      known_hosts_pending_ = false;
+      known_hosts_promise_.set_value(dict.Get("known_hosts"));
+    }
+  } else if (dict.HasKey("latency_report")) {
+    ReportLatency();
+  } else if (dict.HasKey("io_trace")) {
+    ReportIOTrace();
+  } else if (dict.HasKey("flush_log")) {
+    FlushLog();
   } else if (dict.HasKey("ssh_agent")) {
     if (ssh_agent_socket_ != nullptr) {
-      ssh_agent_socket_->HandleInput(pp::VarArray(dict.Get("ssh_agent")));
+      ssh_agent_socket_->HandleInput(
+          pp::VarArrayBuffer(dict.Get("ssh_agent")));
     }
   } else {
     Log("HandleMessage(): Got a message of an unexpected type.");
@@ -409,11 +483,11 @@ void MoshClientInstance::Output(OutputType t, const pp::Var& data) {
     case TYPE_GET_SSH_KEY:
       type = "get_ssh_key";
       break;
-    case TYPE_GET_KNOWN_HOSTS:
-      type = "sync_get_known_hosts";
+    case TYPE_LOOKUP_KNOWN_HOSTS:
+      type = "known_hosts_lookup";
       break;
-    case TYPE_SET_KNOWN_HOSTS:
-      type = "sync_set_known_hosts";
+    case TYPE_UPDATE_KNOWN_HOSTS:
+      type = "known_hosts_update";
       break;
     case TYPE_SSH_AGENT:
       type = "ssh-agent";
@@ -421,6 +495,12 @@ void MoshClientInstance::Output(OutputType t, const pp::Var& data) {
     case TYPE_EXIT:
       type = "exit";
       break;
+    case TYPE_LATENCY_REPORT:
+      type = "latency_report";
+      break;
+    case TYPE_IO_TRACE:
+      type = "io_trace";
+      break;
     default:
       // Bad type.
       return;
@@ -432,48 +512,119 @@ void MoshClientInstance::Output(OutputType t, const pp::Var& data) {
   PostMessage(dict);
 }
 
-void MoshClientInstance::Logv(OutputType t, const string& format,
+void MoshClientInstance::ReportLatency() {
+  if (latency_tracer_ == nullptr) {
+    return;
+  }
+  static const char* const kStageNames[] = {"input", "read", "send",
+                                            "receive", "display"};
+  const auto report = latency_tracer_->report();
+  pp::VarArray bucket_ms;
+  for (int i = 0; i < LatencyTracer::kBuckets; ++i) {
+    bucket_ms.Set(i, 1 << i);
+  }
+  pp::VarDictionary stages;
+  for (int s = LatencyTracer::READ; s < LatencyTracer::NUM_STAGES; ++s) {
+    const auto& histogram = report.stages[s];
+    pp::VarArray counts;
+    for (int i = 0; i < LatencyTracer::kBuckets; ++i) {
+      counts.Set(i, static_cast<double>(histogram.counts[i]));
+    }
+    pp::VarDictionary stage;
+    stage.Set("counts", counts);
+    stage.Set("mean_ms", histogram.samples == 0 ? 0.0
+                                                : histogram.total_us / 1000.0 /
+                                                      histogram.samples);
+    stage.Set("max_ms", histogram.max_us / 1000.0);
+    stages.Set(kStageNames[s], stage);
+  }
+  pp::VarDictionary data;
+  data.Set("bucket_ms", bucket_ms);
+  data.Set("stages", stages);
+  data.Set("completed", static_cast<double>(report.completed));
+  data.Set("abandoned", static_cast<double>(report.abandoned));
+  Output(TYPE_LATENCY_REPORT, data);
+}
+
+void MoshClientInstance::ReportIOTrace() {
+  if (io_trace_ == nullptr) {
+    return;
+  }
+  const string trace = io_trace_->data();
+  const uint64_t dropped = io_trace_->dropped();
+  if (dropped > 0) {
+    Log("I/O trace is full; %llu records were dropped.",
+        static_cast<unsigned long long>(dropped));  // NOLINT(runtime/int)
+  }
+  pp::VarArrayBuffer buffer(trace.size());
+  memcpy(buffer.Map(), trace.data(), trace.size());
+  buffer.Unmap();
+  Output(TYPE_IO_TRACE, buffer);
+}
+
+void MoshClientInstance::Logv(Logger::Severity severity, const char* format,
                               va_list argp) {
-  char buf[1024];
-  int size = vsnprintf(buf, sizeof(buf), format.c_str(), argp);
-  Output(t, string((const char*)buf, size));
+  logger_.Logv(severity, format, argp);
+  if (severity == Logger::ERROR) {
+    FlushLog();
+  }
 }
 
 void MoshClientInstance::Log(const char* format, ...) {
   va_list argp;
   va_start(argp, format);
-  Logv(TYPE_LOG, format, argp);
+  Logv(Logger::INFO, format, argp);
   va_end(argp);
 }
 
 void MoshClientInstance::Error(const char* format, ...) {
   va_list argp;
   va_start(argp, format);
-  Logv(TYPE_ERROR, format, argp);
+  va_list log_argp;
+  va_copy(log_argp, argp);
+  Logv(Logger::ERROR, format, log_argp);
+  va_end(log_argp);
+  char buf[1024];
+  vsnprintf(buf, sizeof(buf), format, argp);
   va_end(argp);
+  Output(TYPE_ERROR, string(buf));
+}
+
+void MoshClientInstance::FlushLog() {
+  const string log = logger_.Drain();
+  if (!log.empty()) {
+    Output(TYPE_LOG, log);
+  }
 }
 
 bool MoshClientInstance::Init(uint32_t argc, const char* argn[],
                               const char* argv[]) {
-  // Setup communications. We keep pointers to |keyboard_| and
-  // |window_change_|, as we need to access their specialized methods. |posix_|
-  // owns them, but we own |posix_|, so it is all good so long as these "files"
-  // are not closed.
+  // Setup communications. We keep pointers to |keyboard_|, |terminal_|, and
+  // |window_change_|, as we need to access their specialized methods.
+  // |posix_| owns them, but we own |posix_|, so it is all good so long as
+  // these "files" are not closed.
   auto keyboard = make_unique<Keyboard>();
+  auto terminal = make_unique<Terminal>(*this);
   auto window_change = make_unique<WindowChange>();
   keyboard_ = keyboard.get();
+  terminal_ = terminal.get();
   window_change_ = window_change.get();
   posix_ = make_unique<PepperPOSIX::POSIX>(
-      this, move(keyboard), make_unique<Terminal>(*this),
-      make_unique<ErrorLog>(*this), move(window_change));
+      this, move(keyboard), move(terminal), make_unique<ErrorLog>(*this),
+      move(window_change));
   posix_->RegisterFile("/dev/urandom",
                        []() { return make_unique<DevURandom>(); });
-  posix_->RegisterUnixSocketStream(
-      [this]() { return make_unique<UnixSocketStreamImpl>(this); });
+  posix_->RegisterSocket(AF_UNIX, SOCK_STREAM, 0, [this]() {
+    return make_unique<UnixSocketStreamImpl>(this);
+  });
 
   // Parse arguments.
   const char* secret = nullptr;
   string mosh_escape_key;
+  bool use_io_thread = true;
+  PepperPOSIX::Impairment::Config impairment;
+  bool trace_latency = false;
+  bool trace_io = false;
   for (int i = 0; i < argc; ++i) {
     string name = argn[i];
     int len = strlen(argv[i]) + 1;
@@ -517,6 +668,64 @@ bool MoshClientInstance::Init(uint32_t argc, const char* argn[],
       if (string(argv[i]) == "true") {
         ssh_login_.set_trust_sshfp(true);
       }
+    } else if (name == "adaptive-spin") {
+      posix_->SetAdaptiveSpin(string(argv[i]) == "true");
+    } else if (name == "io-thread") {
+      use_io_thread = string(argv[i]) != "false";
+    } else if (name == "trace-latency") {
+      trace_latency = string(argv[i]) == "true";
+    } else if (name == "trace-io") {
+      trace_io = string(argv[i]) == "true";
+    } else if (name == "network-impairment") {
+      if (!impairment.Parse(argv[i])) {
+        Error("Bad network-impairment '%s'.", argv[i]);
+        return true;
+      }
+    }
+  }
+  posix_->SetIOThread(use_io_thread);
+  if (trace_latency) {
+    latency_tracer_ = make_unique<LatencyTracer>();
+    keyboard_->set_latency_tracer(latency_tracer_.get());
+  }
+  if (trace_io) {
+    io_trace_ = make_unique<PepperPOSIX::IOTrace>(kIOTraceMaxSize);
+    posix_->SetTrace(io_trace_.get());
+  }
+  if (!impairment.IsNull()) {
+    // For testing only: run Mosh's UDP over a simulated bad network, impaired
+    // the same way, but independently, in each direction.
+    Log("Impairing UDP: delay %d ms, jitter %d ms, loss %g, reorder %g, "
+        "rate %lld bps, seed %u",
+        impairment.delay_ms, impairment.jitter_ms, impairment.loss,
+        impairment.reorder,
+        static_cast<long long>(impairment.rate_bps),  // NOLINT(runtime/int)
+        impairment.seed);
+  }
+  if (latency_tracer_ != nullptr || !impairment.IsNull()) {
+    auto factory = [this, impairment]() {
+      unique_ptr<PepperPOSIX::UDP> udp =
+          make_unique<PepperPOSIX::NativeUDP>(this, posix_->io_thread());
+      if (latency_tracer_ != nullptr) {
+        // Innermost, so that any impairment counts toward the latency.
+        LatencyTracer* tracer = latency_tracer_.get();
+        udp = make_unique<PepperPOSIX::TracedUDP>(
+            move(udp), [tracer](bool sent) {
+              tracer->Mark(sent ? LatencyTracer::SEND
+                                : LatencyTracer::RECEIVE);
+            });
+      }
+      if (!impairment.IsNull()) {
+        auto inbound = impairment;
+        ++inbound.seed;
+        udp = make_unique<PepperPOSIX::ImpairedUDP>(move(udp), impairment,
+                                                    inbound);
+      }
+      return udp;
+    };
+    for (int domain : {AF_INET, AF_INET6}) {
+      posix_->RegisterSocket(domain, SOCK_DGRAM, 0, factory);
+      posix_->RegisterSocket(domain, SOCK_DGRAM, IPPROTO_UDP, factory);
     }
   }
 
@@ -542,6 +751,9 @@ bool MoshClientInstance::Init(uint32_t argc, const char* argn[],
     // Use default resolver.
     resolver_ = make_unique<PepperResolver>(this);
   }
+  // Name lookups are shared by the ssh login, getaddrinfo(), and Mosh.
+  resolver_ = make_unique<CachingResolver>(move(resolver_), kDNSCacheSeconds);
+  posix_->SetResolver(resolver_.get(), type_);
 
   if (ssh_mode_) {
     // HandleMessage() will call LaunchSSHLogin().
@@ -561,14 +773,20 @@ void MoshClientInstance::LaunchManual(Resolver::Error error,
                                       Resolver::Authenticity authenticity,
                                       vector<string> results) {
   if (resolver_->IsValidating()) {
+    // Goes through the Terminal, like all display output, so that its flow
+    // control accounts for the acknowledgement.
+    const char* message = nullptr;
     switch (authenticity) {
       case Resolver::Authenticity::AUTHENTIC:
-        Output(TYPE_DISPLAY, "Authenticated DNS lookup.\r\n");
+        message = "Authenticated DNS lookup.\r\n";
         break;
       case Resolver::Authenticity::INSECURE:
-        Output(TYPE_DISPLAY, "Could NOT authenticate DNS lookup.\r\n");
+        message = "Could NOT authenticate DNS lookup.\r\n";
         break;
     }
+    if (message != nullptr) {
+      terminal_->Write(message, strlen(message));
+    }
   }
   if (error == Resolver::Error::NOT_RESOLVED) {
     Error(
@@ -624,6 +842,9 @@ void* MoshClientInstance::MoshThread(void* data) {
   mosh_main(sizeof(argv) / sizeof(argv[0]), argv);
   thiz->Log("Mosh(): mosh_main returned");
 
+  thiz->ReportLatency();
+  thiz->ReportIOTrace();
+  thiz->FlushLog();
   thiz->Output(TYPE_EXIT, "");
   return nullptr;
 }
@@ -633,6 +854,8 @@ void MoshClientInstance::LaunchSSHLogin() {
   ssh_login_.set_type(type_);
   ssh_login_.set_port(string(port_.get()));
   ssh_login_.set_resolver(resolver_.get());
+  ssh_login_.set_known_hosts_lookup(
+      [this](const vector<string>& names) { return LookupKnownHosts(names); });
   setenv("SSH_AUTH_SOCK", "agent", 1);  // Connects to UnixSocketStreamImpl.
 
   int thread_err = pthread_create(&thread_, nullptr, SSHLoginThread, this);
@@ -661,7 +884,10 @@ void* MoshClientInstance::SSHLoginThread(void* data) {
   setenv("MOSH_KEY", thiz->ssh_login_.mosh_key().c_str(), 1);
 
   // Save any updates to known hosts.
-  thiz->Output(TYPE_SET_KNOWN_HOSTS, thiz->ssh_login_.known_hosts());
+  const pp::VarDictionary changes = thiz->ssh_login_.known_hosts_changes();
+  if (changes.GetKeys().GetLength() > 0) {
+    thiz->Output(TYPE_UPDATE_KNOWN_HOSTS, changes);
+  }
 
   pp::Module::Get()->core()->CallOnMainThread(
       0, thiz->cc_factory_.NewCallback(&MoshClientInstance::LaunchMosh));
@@ -669,16 +895,53 @@ void* MoshClientInstance::SSHLoginThread(void* data) {
   return nullptr;
 }
 
+pp::VarDictionary MoshClientInstance::LookupKnownHosts(
+    const vector<string>& names) {
+  std::future<pp::Var> answer;
+  {
+    pthread::MutexLock m(known_hosts_lock_);
+    known_hosts_promise_ = std::promise<pp::Var>();
+    known_hosts_pending_ = true;
+    answer = known_hosts_promise_.get_future();
+  }
+  pp::VarArray request;
+  for (size_t i = 0; i < names.size(); ++i) {
+    request.Set(i, names[i]);
+  }
+  Output(TYPE_LOOKUP_KNOWN_HOSTS, request);
+
+  const pp::Var entries = answer.get();
+  if (!entries.is_dictionary()) {
+    return pp::VarDictionary();
+  }
+  return pp::VarDictionary(entries);
+}
+
 // Initialize static data for MoshClientInstance.
 int MoshClientInstance::num_instances_ = 0;
 
 ssize_t Terminal::Write(const void* buf, size_t count) {
-  string s((const char*)buf, count);
-  instance_.Output(MoshClientInstance::TYPE_DISPLAY, s);
+  string s;
+  utf8_splitter_.Split(buf, count, &s);
+  if (!s.empty()) {
+    if (instance_.latency_tracer() != nullptr) {
+      instance_.latency_tracer()->Mark(LatencyTracer::DISPLAY);
+    }
+    {
+      pthread::MutexLock m(unacked_lock_);
+      unacked_sizes_.push_back(s.size());
+      unacked_bytes_ += s.size();
+      target_->UpdateWrite(unacked_bytes_ < kDisplayWindow_);
+    }
+    instance_.Output(MoshClientInstance::TYPE_DISPLAY, s);
+  }
   return count;
 }
 
 ssize_t ErrorLog::Write(const void* buf, size_t count) {
+  // Mosh writes to stderr when something goes wrong; send the log leading up
+  // to it.
+  instance_.FlushLog();
   string s((const char*)buf, count);
   instance_.Output(MoshClientInstance::TYPE_ERROR, s);
   return count;
@@ -747,7 +1010,16 @@ void Log(const char* format, ...) {
   va_list argp;
   va_start(argp, format);
   if (instance != nullptr) {
-    instance->Logv(MoshClientInstance::TYPE_LOG, format, argp);
+    instance->Logv(Logger::INFO, format, argp);
+  }
+  va_end(argp);
+}
+
+void LogError(const char* format, ...) {
+  va_list argp;
+  va_start(argp, format);
+  if (instance != nullptr) {
+    instance->Logv(Logger::ERROR, format, argp);
   }
   va_end(argp);
 }
@@ -22,11 +22,15 @@
 #define MOSH_NACL_MOSH_NACL_H_
 
 #include <pthread.h>
+#include <future>  // NOLINT(build/c++11)
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "mosh_nacl/latency_tracer.h"
+#include "mosh_nacl/logger.h"
 #include "mosh_nacl/pepper_wrapper.h"
+#include "mosh_nacl/pthread_locks.h"
 #include "mosh_nacl/resolver.h"
 #include "mosh_nacl/ssh_login.h"
 
@@ -54,24 +58,39 @@ class MoshClientInstance : public pp::Instance {
     TYPE_LOG,
     TYPE_ERROR,
     TYPE_GET_SSH_KEY,
-    TYPE_GET_KNOWN_HOSTS,
-    TYPE_SET_KNOWN_HOSTS,
+    TYPE_LOOKUP_KNOWN_HOSTS,
+    TYPE_UPDATE_KNOWN_HOSTS,
     TYPE_SSH_AGENT,
     TYPE_EXIT,
+    TYPE_LATENCY_REPORT,
+    TYPE_IO_TRACE,
   };
 
   // Low-level function to output data to Javascript.
   void Output(OutputType t, const pp::Var& data);
 
-  // Sends messages to the Javascript console log.
-  void Logv(OutputType t, const std::string& format, va_list argp);
+  // Records messages for the Javascript console log. ERROR messages flush the
+  // log at once. |format| must be a string literal.
+  void Logv(Logger::Severity severity, const char* format, va_list argp);
 
-  // Sends messages to the Javascript console log.
+  // Records messages for the Javascript console log.
   void Log(const char* format, ...);
 
   // Sends error messages to the Javascript console log and terminal.
   void Error(const char* format, ...);
 
+  // Sends the recorded log messages to the Javascript console log.
+  void FlushLog();
+
+  // Sends the keystroke latency histograms to Javascript, if tracing.
+  void ReportLatency();
+
+  // Sends the I/O trace so far to Javascript, if tracing.
+  void ReportIOTrace();
+
+  // The keystroke latency tracer, or nullptr if not tracing.
+  LatencyTracer* latency_tracer() { return latency_tracer_.get(); }
+
   // Set the SSH agent socket for use by HandleMessage() to deliver agent data.
   // Should be set to nullptr once the socket is closed.
   void set_ssh_agent_socket(class UnixSocketStreamImpl* socket) {
@@ -101,6 +120,10 @@ class MoshClientInstance : public pp::Instance {
   // Launches SSHLogin in a new thread.
   void LaunchSSHLogin();
 
+  // Asks Javascript for the stored fingerprints of |names|, and waits for
+  // them. Must not be called on the main thread.
+  pp::VarDictionary LookupKnownHosts(const std::vector<std::string>& names);
+
   // New thread entry point for SSHLogin. |data| is |this|.
   static void* SSHLoginThread(void* data);
 
@@ -122,11 +145,28 @@ class MoshClientInstance : public pp::Instance {
   SSHLogin ssh_login_;
   class UnixSocketStreamImpl* ssh_agent_socket_ = nullptr;
 
+  // The answer to LookupKnownHosts(), while one is awaited. Guard these with
+  // known_hosts_lock_.
+  std::promise<pp::Var> known_hosts_promise_;
+  bool known_hosts_pending_ = false;
+  pthread::Mutex known_hosts_lock_;
+
   // Resolver to use for DNS lookups.
   std::unique_ptr<Resolver> resolver_;
 
+  // I/O trace for replay; nullptr unless tracing.
+  std::unique_ptr<PepperPOSIX::IOTrace> io_trace_;
+
+  // Log messages waiting for FlushLog().
+  Logger logger_;
+
+  // Keystroke latency tracer; nullptr unless tracing.
+  std::unique_ptr<LatencyTracer> latency_tracer_;
+
   // Class POSIX takes ownership of this, but keeping pointer for convenience.
   class Keyboard* keyboard_ = nullptr;
+  // Class POSIX takes ownership of this, but keeping pointer for convenience.
+  class Terminal* terminal_ = nullptr;
   pp::CompletionCallbackFactory<MoshClientInstance> cc_factory_;
 
   // Disable copy and assignment.
@@ -20,17 +20,25 @@
 
 #include "mosh_nacl/pepper_posix.h"
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
+#include <algorithm>
+#include <future>
 #include <memory>
 #include <utility>
 #include <vector>
 
+#include "mosh_nacl/pepper_posix_io_thread.h"
 #include "mosh_nacl/pepper_posix_native_tcp.h"
 #include "mosh_nacl/pepper_posix_native_udp.h"
 #include "mosh_nacl/pepper_posix_tcp.h"
@@ -45,24 +53,42 @@ using std::unique_ptr;
 using std::vector;
 using util::make_unique;
 
+int File::SetSockOpt(int level, int optname, int value) {
+  options_[std::make_pair(level, optname)] = value;
+  return 0;
+}
+
+int File::GetSockOpt(int level, int optname, int* value) {
+  auto iter = options_.find(std::make_pair(level, optname));
+  if (iter == options_.end()) {
+    errno = ENOPROTOOPT;
+    return -1;
+  }
+  *value = iter->second;
+  return 0;
+}
+
 const int SIGNAL_FD = -1;
+const int EVENTS_FD = -2;
 
 POSIX::POSIX(const pp::InstanceHandle instance_handle,
              unique_ptr<Reader> std_in, unique_ptr<Writer> std_out,
              unique_ptr<Writer> std_err, unique_ptr<Signal> signal)
-    : signal_(move(signal)), instance_handle_(instance_handle) {
+    : signal_(move(signal)),
+      events_(selector_, EVENTS_FD),
+      instance_handle_(instance_handle) {
   if (std_in != nullptr) {
-    std_in->target_ = selector_.NewTarget(STDIN_FILENO);
+    Register(std_in.get(), STDIN_FILENO);
   }
   files_[STDIN_FILENO] = move(std_in);
   if (std_out != nullptr) {
-    std_out->target_ = selector_.NewTarget(STDOUT_FILENO);
+    Register(std_out.get(), STDOUT_FILENO);
     // Prevent buffering in stdout.
     assert(setvbuf(stdout, nullptr, _IONBF, 0) == 0);
   }
   files_[STDOUT_FILENO] = move(std_out);
   if (std_err != nullptr) {
-    std_err->target_ = selector_.NewTarget(STDERR_FILENO);
+    Register(std_err.get(), STDERR_FILENO);
     // Prevent buffering in stderr, but keep line mode as that works better for
     // keeping log lines together.
     assert(setvbuf(stderr, nullptr, _IOLBF, 0) == 0);
@@ -73,6 +99,50 @@ POSIX::POSIX(const pp::InstanceHandle instance_handle,
     // range.
     signal_->target_ = selector_.NewTarget(SIGNAL_FD);
   }
+
+  // Default transports. The I/O thread is looked up when each socket is
+  // made, as SetIOThread() may change it.
+  for (int domain : {AF_INET, AF_INET6}) {
+    auto udp = [this]() -> unique_ptr<File> {
+      return make_unique<NativeUDP>(instance_handle_, io_thread_.get());
+    };
+    RegisterSocket(domain, SOCK_DGRAM, 0, udp);
+    RegisterSocket(domain, SOCK_DGRAM, IPPROTO_UDP, udp);
+    auto tcp = [this]() -> unique_ptr<File> {
+      return make_unique<NativeTCP>(instance_handle_, io_thread_.get());
+    };
+    RegisterSocket(domain, SOCK_STREAM, 0, tcp);
+    RegisterSocket(domain, SOCK_STREAM, IPPROTO_TCP, tcp);
+  }
+}
+
+POSIX::~POSIX() {
+  if (io_thread_ != nullptr) {
+    const auto stats = io_thread_->stats();
+    Log("POSIX: I/O thread ran %llu tasks; delay total %llu us, max %u us; "
+        "busy %llu us; %llu completions, busy %llu us",
+        static_cast<unsigned long long>(stats.tasks),  // NOLINT(runtime/int)
+        static_cast<unsigned long long>(  // NOLINT(runtime/int)
+            stats.total_delay_us),
+        stats.max_delay_us,
+        static_cast<unsigned long long>(stats.busy_us),      // NOLINT
+        static_cast<unsigned long long>(stats.completions),  // NOLINT
+        static_cast<unsigned long long>(  // NOLINT(runtime/int)
+            stats.completion_busy_us));
+  }
+}
+
+void POSIX::SetIOThread(bool enabled) {
+  if (!enabled) {
+    io_thread_.reset();
+    return;
+  }
+  if (io_thread_ == nullptr) {
+    io_thread_ = make_unique<IOThread>(instance_handle_);
+    if (!io_thread_->Start()) {
+      io_thread_.reset();
+    }
+  }
 }
 
 int POSIX::Open(const char* pathname, __attribute__((unused)) int flags,
@@ -87,7 +157,7 @@ int POSIX::Open(const char* pathname, __attribute__((unused)) int flags,
   // cannot be O_WRONLY).
   int fd = NextFileDescriptor();
   files_[fd] = factories_iter->second();
-  files_[fd]->target_ = selector_.NewTarget(fd);
+  Register(files_[fd].get(), fd);
   return fd;
 }
 
@@ -117,7 +187,9 @@ ssize_t POSIX::Read(int fd, void* buf, size_t count) {
   if (reader->IsBlocking()) {
     vector<Target*> read_targets, write_targets;
     read_targets.push_back(reader->target_.get());
-    selector_.Select(read_targets, write_targets, nullptr);
+    Wait(read_targets, write_targets, nullptr);
+  } else {
+    DispatchEvents();
   }
 
   return reader->Read(buf, count);
@@ -137,10 +209,14 @@ ssize_t POSIX::Write(int fd, const void* buf, size_t count) {
   if (writer->IsBlocking()) {
     vector<Target*> read_targets, write_targets;
     write_targets.push_back(writer->target_.get());
-    selector_.Select(read_targets, write_targets, nullptr);
+    Wait(read_targets, write_targets, nullptr);
   }
 
-  return writer->Write(buf, count);
+  const ssize_t result = writer->Write(buf, count);
+  if (trace_ != nullptr) {
+    trace_->AddSend(fd, buf, result);
+  }
+  return result;
 }
 
 int POSIX::NextFileDescriptor() {
@@ -151,25 +227,81 @@ int POSIX::NextFileDescriptor() {
   }
 }
 
-int POSIX::Socket(int domain, int type, int protocol) {
-  unique_ptr<File> file;
+void POSIX::Register(File* file, int fd) {
+  file->target_ = selector_.NewTarget(fd);
+  file->events_ = &events_;
+  file->serial_ = ++next_serial_;
+}
 
-  if (domain == AF_UNIX && protocol == 0) {
-    if (type == SOCK_STREAM && unix_socket_stream_factory_) {
-      file = unix_socket_stream_factory_();
+void POSIX::DispatchEvents() {
+  events_.Take(&event_batch_);
+  for (auto& event : event_batch_) {
+    auto iter = files_.find(event.fd);
+    if (iter == files_.end() || iter->second == nullptr ||
+        iter->second->serial_ != event.serial) {
+      // The File was closed after the event was queued.
+      continue;
     }
-  } else {
-    if (domain != AF_INET && domain != AF_INET6) {
-      errno = EINVAL;
-      return -1;
+    if (trace_ != nullptr) {
+      trace_->AddEvent(event);
     }
-    if (type == SOCK_DGRAM && (protocol == 0 || protocol == IPPROTO_UDP)) {
-      file = make_unique<NativeUDP>(instance_handle_);
-    } else if (type == SOCK_STREAM &&
-               (protocol == 0 || protocol == IPPROTO_TCP)) {
-      file = make_unique<NativeTCP>(instance_handle_);
+    iter->second->HandleEvent(move(event));
+  }
+  event_batch_.clear();
+}
+
+vector<Target*> POSIX::Wait(vector<Target*> read_targets,
+                            const vector<Target*>& write_targets,
+                            const struct timespec* timeout) {
+  // Deliver what is already queued, so that Files are up to date before the
+  // first check.
+  DispatchEvents();
+
+  struct timespec deadline;
+  if (timeout != nullptr) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    deadline = TimespecAdd(now, *timeout);
+  }
+
+  read_targets.push_back(events_.target());
+  struct timespec remaining;
+  const struct timespec* wait_timeout = timeout;
+  for (;;) {
+    vector<Target*> ready =
+        selector_.Select(read_targets, write_targets, wait_timeout);
+    auto events_iter = find(ready.begin(), ready.end(), events_.target());
+    if (events_iter == ready.end()) {
+      return ready;
+    }
+    ready.erase(events_iter);
+    DispatchEvents();
+    if (ready.size() > 0) {
+      return ready;
+    }
+
+    // The events may have made the targets ready, or may have been for other
+    // Files; check again, and keep waiting for the rest of the timeout.
+    if (timeout != nullptr) {
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      remaining = TimespecSubtract(deadline, now);
+      if (remaining.tv_sec < 0) {
+        remaining.tv_sec = 0;
+        remaining.tv_nsec = 0;
+      }
+      wait_timeout = &remaining;
     }
   }
+}
+
+int POSIX::Socket(int domain, int type, int protocol) {
+  unique_ptr<File> file;
+  auto factory =
+      socket_factories_.find(std::make_tuple(domain, type, protocol));
+  if (factory != socket_factories_.end() && factory->second) {
+    file = factory->second();
+  }
 
   if (file == nullptr) {
     errno = EINVAL;
@@ -177,7 +309,7 @@ int POSIX::Socket(int domain, int type, int protocol) {
   }
 
   int fd = NextFileDescriptor();
-  file->target_ = selector_.NewTarget(fd);
+  Register(file.get(), fd);
   if (type == SOCK_STREAM) {
     // SOCK_STREAM should not be writable at first.
     file->target_->UpdateWrite(false);
@@ -225,8 +357,7 @@ int POSIX::PSelect(int nfds, fd_set* readfds, fd_set* writefds,
     read_targets.push_back(signal_->target_.get());
   }
 
-  vector<Target*> ready_targets =
-      selector_.Select(read_targets, write_targets, timeout);
+  vector<Target*> ready_targets = Wait(read_targets, write_targets, timeout);
 
   for (const auto* target : ready_targets) {
     const int fd = target->id();
@@ -238,15 +369,13 @@ int POSIX::PSelect(int nfds, fd_set* readfds, fd_set* writefds,
       continue;
     }
 
-    if (readfds != nullptr && FD_ISSET(fd, readfds) &&
-        target->has_read_data()) {
+    // Errors and hang-ups make a target both readable and writable.
+    if (readfds != nullptr && FD_ISSET(fd, readfds) && target->readable()) {
       FD_SET(fd, &new_readfds);
-      ++result;
     }
     if (writefds != nullptr && FD_ISSET(fd, writefds) &&
-        target->has_write_data()) {
+        target->writable()) {
       FD_SET(fd, &new_writefds);
-      ++result;
     }
   }
 
@@ -259,12 +388,15 @@ int POSIX::PSelect(int nfds, fd_set* readfds, fd_set* writefds,
   if (exceptfds != nullptr) {
     FD_ZERO(exceptfds);
   }
+  // A target in both sets appears twice in |ready_targets|, so count here.
   for (int fd = 0; fd < nfds; ++fd) {
     if (FD_ISSET(fd, &new_readfds)) {
       FD_SET(fd, readfds);
+      ++result;
     }
     if (FD_ISSET(fd, &new_writefds)) {
       FD_SET(fd, writefds);
+      ++result;
     }
   }
 
@@ -283,54 +415,88 @@ int POSIX::Select(int nfds, fd_set* readfds, fd_set* writefds,
 }
 
 int POSIX::Poll(struct pollfd* fds, nfds_t nfds, int timeout) {
-  // Poll() is used infrequently, so just wrap PSelect(). This is an imperfect
-  // implementation, but suffices.
-  fd_set readfds, writefds, exceptfds;
-  int pselect_nfds = 0;
-
-  FD_ZERO(&readfds);
-  FD_ZERO(&writefds);
-  FD_ZERO(&exceptfds);
+  vector<Target*> read_targets, write_targets;
+  bool invalid = false;
   for (int i = 0; i < nfds; ++i) {
-    const auto& fd = fds[i].fd;
-    const auto& events = fds[i].events;
-
-    if (events & (POLLIN | POLLPRI)) {
-      FD_SET(fd, &readfds);
+    fds[i].revents = 0;
+    const int fd = fds[i].fd;
+    if (fd < 0) {
+      // Negative fds are ignored, per poll(2).
+      continue;
     }
-    if (events & POLLOUT) {
-      FD_SET(fd, &writefds);
+    auto iter = files_.find(fd);
+    if (iter == files_.end() || iter->second == nullptr) {
+      invalid = true;
+      continue;
     }
-    if (events & (POLLERR | POLLHUP | POLLNVAL)) {
-      FD_SET(fd, &exceptfds);
+    Target* target = iter->second->target_.get();
+    if (fds[i].events & (POLLIN | POLLPRI)) {
+      read_targets.push_back(target);
     }
-
-    if (pselect_nfds <= fd) {
-      pselect_nfds = fd + 1;
+    if (fds[i].events & POLLOUT) {
+      write_targets.push_back(target);
     }
   }
 
+  // Signal is handled specially.
+  if (signal_ != nullptr) {
+    read_targets.push_back(signal_->target_.get());
+  }
+
+  // |timeout| is in milliseconds, and negative means forever. POLLNVAL is
+  // reported without waiting.
   struct timespec ts;
-  // |timeout| is in milliseconds.
-  ts.tv_sec = timeout / 1000;
-  ts.tv_nsec = (timeout % 1000) * 1000000;
+  const struct timespec* wait_timeout = nullptr;
+  if (invalid) {
+    ts.tv_sec = 0;
+    ts.tv_nsec = 0;
+    wait_timeout = &ts;
+  } else if (timeout >= 0) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+    wait_timeout = &ts;
+  }
 
-  int result =
-      PSelect(pselect_nfds, &readfds, &writefds, &exceptfds, &ts, nullptr);
+  Wait(read_targets, write_targets, wait_timeout);
 
+  if (signal_ != nullptr && signal_->target_->has_read_data()) {
+    signal_->Handle();
+  }
+
+  int result = 0;
   for (int i = 0; i < nfds; ++i) {
-    const auto& fd = fds[i].fd;
+    const int fd = fds[i].fd;
+    const auto events = fds[i].events;
     auto& revents = fds[i].revents;
+    if (fd < 0) {
+      continue;
+    }
+    auto iter = files_.find(fd);
+    if (iter == files_.end() || iter->second == nullptr) {
+      revents = POLLNVAL;
+      ++result;
+      continue;
+    }
 
-    // Cheating: Just setting every potentially related bit.
-    if (FD_ISSET(fd, &readfds)) {
-      revents |= POLLIN | POLLPRI;
+    const Target* target = iter->second->target_.get();
+    // A hang-up leaves the end of file to be read.
+    if ((events & POLLIN) && (target->has_read_data() || target->hung_up())) {
+      revents |= POLLIN;
     }
-    if (FD_ISSET(fd, &writefds)) {
+    if ((events & POLLOUT) && target->has_write_data()) {
       revents |= POLLOUT;
     }
-    if (FD_ISSET(fd, &exceptfds)) {
-      revents |= POLLERR | POLLHUP | POLLNVAL;
+    // Errors and hang-ups are always reported, whether requested or not. A
+    // failed connection can neither be read from nor written to again.
+    if (target->has_error()) {
+      revents |= POLLERR | POLLHUP;
+    }
+    if (target->hung_up()) {
+      revents |= POLLHUP;
+    }
+
+    if (revents != 0) {
+      ++result;
     }
   }
 
@@ -351,7 +517,9 @@ ssize_t POSIX::Recv(int sockfd, void* buf, size_t len, int flags) {
   if (tcp->IsBlocking() && !(flags & MSG_DONTWAIT)) {
     vector<Target*> read_targets, write_targets;
     read_targets.push_back(tcp->target_.get());
-    selector_.Select(read_targets, write_targets, nullptr);
+    Wait(read_targets, write_targets, nullptr);
+  } else {
+    DispatchEvents();
   }
 
   return tcp->Receive(buf, len, flags);
@@ -371,7 +539,9 @@ ssize_t POSIX::RecvMsg(int sockfd, struct msghdr* msg, int flags) {
   if (udp->IsBlocking() && !(flags & MSG_DONTWAIT)) {
     vector<Target*> read_targets, write_targets;
     read_targets.push_back(udp->target_.get());
-    selector_.Select(read_targets, write_targets, nullptr);
+    Wait(read_targets, write_targets, nullptr);
+  } else {
+    DispatchEvents();
   }
 
   return udp->Receive(msg, flags);
@@ -416,6 +586,10 @@ ssize_t POSIX::Send(int sockfd, const void* buf, size_t len, int flags) {
   if (files_.count(sockfd) == 0) {
     return EBADF;
   }
+  if (dynamic_cast<UDP*>(files_[sockfd].get()) != nullptr) {
+    // send() on a UDP socket goes to the connected destination.
+    return SendTo(sockfd, buf, len, flags, nullptr, 0);
+  }
   TCP* tcp = dynamic_cast<TCP*>(files_[sockfd].get());
   if (tcp == nullptr) {
     errno = EBADF;
@@ -425,10 +599,14 @@ ssize_t POSIX::Send(int sockfd, const void* buf, size_t len, int flags) {
   if (tcp->IsBlocking() && !(flags & MSG_DONTWAIT)) {
     vector<Target*> read_targets, write_targets;
     write_targets.push_back(tcp->target_.get());
-    selector_.Select(read_targets, write_targets, nullptr);
+    Wait(read_targets, write_targets, nullptr);
   }
 
-  return tcp->Send(buf, len, flags);
+  const ssize_t result = tcp->Send(buf, len, flags);
+  if (trace_ != nullptr) {
+    trace_->AddSend(sockfd, buf, result);
+  }
+  return result;
 }
 
 ssize_t POSIX::SendTo(int sockfd, const void* buf, size_t len, int flags,
@@ -442,14 +620,46 @@ ssize_t POSIX::SendTo(int sockfd, const void* buf, size_t len, int flags,
     return -1;
   }
 
+  if (dest_addr != nullptr) {
+    // MakeAddress() asserts on an address it can't convert.
+    const int error = UDP::CheckAddress(dest_addr, addrlen);
+    if (error != 0) {
+      errno = error;
+      return -1;
+    }
+  }
+
   if (udp->IsBlocking() && !(flags & MSG_DONTWAIT)) {
     vector<Target*> read_targets, write_targets;
     write_targets.push_back(udp->target_.get());
-    selector_.Select(read_targets, write_targets, nullptr);
+    Wait(read_targets, write_targets, nullptr);
   }
 
-  vector<char> buffer((const char*)buf, (const char*)buf + len);
-  return udp->Send(move(buffer), flags, MakeAddress(dest_addr, addrlen));
+  ssize_t result;
+  if (dest_addr == nullptr) {
+    const pp::NetAddress* connected_address = udp->connected_address();
+    if (connected_address == nullptr) {
+      errno = EDESTADDRREQ;
+      return -1;
+    }
+    result = udp->Send(buf, len, flags, *connected_address);
+  } else {
+    // Reuse the pp::NetAddress from the last datagram to this destination, if
+    // any, rather than allocating a new resource for every packet.
+    const pp::NetAddress* cached_address =
+        udp->CachedAddress(dest_addr, addrlen);
+    if (cached_address != nullptr) {
+      result = udp->Send(buf, len, flags, *cached_address);
+    } else {
+      const pp::NetAddress address = MakeAddress(dest_addr, addrlen);
+      udp->CacheAddress(dest_addr, addrlen, address);
+      result = udp->Send(buf, len, flags, address);
+    }
+  }
+  if (trace_ != nullptr) {
+    trace_->AddSend(sockfd, buf, result);
+  }
+  return result;
 }
 
 int POSIX::FCntl(int fd, int cmd, va_list arg) {
@@ -499,6 +709,15 @@ int POSIX::Connect(int sockfd, const struct sockaddr* addr, socklen_t addrlen) {
     return tcp->Connect(MakeAddress(addr, addrlen));
   }
 
+  UDP* udp = dynamic_cast<UDP*>(file);
+  if (udp != nullptr) {
+    // Only make a pp::NetAddress of |addr| once it is known to be usable.
+    const pp::NetAddress address = UDP::CheckAddress(addr, addrlen) == 0
+                                       ? MakeAddress(addr, addrlen)
+                                       : pp::NetAddress();
+    return udp->Connect(addr, addrlen, address);
+  }
+
   UnixSocketStream* unix_socket = dynamic_cast<UnixSocketStream*>(file);
   if (unix_socket != nullptr) {
     const struct sockaddr_un* addr_un = (const struct sockaddr_un*)addr;
@@ -515,30 +734,249 @@ int POSIX::Connect(int sockfd, const struct sockaddr* addr, socklen_t addrlen) {
 
 int POSIX::GetSockOpt(int sockfd, int level, int optname, void* optval,
                       socklen_t* optlen) {
-  if (files_.count(sockfd) == 0) {
-    return EBADF;
-  }
-  TCP* tcp = dynamic_cast<TCP*>(files_[sockfd].get());
-  if (tcp == nullptr) {
+  if (files_.count(sockfd) == 0 || files_[sockfd] == nullptr) {
     errno = EBADF;
     return -1;
   }
+  File* file = files_[sockfd].get();
+  if (*optlen < sizeof(int)) {
+    errno = EINVAL;
+    return -1;
+  }
 
   if (optname == SO_ERROR && level == SOL_SOCKET) {
     // This allows nonblocking TCP connections to discover the disposition of a
     // connection attempt.
-    if (*optlen < sizeof(tcp->connection_errno_)) {
-      errno = EINVAL;
-      return -1;
+    Stream* stream = dynamic_cast<Stream*>(file);
+    if (stream == nullptr) {
+      *reinterpret_cast<int*>(optval) = 0;
+      *optlen = sizeof(int);
+      return 0;
     }
-    *reinterpret_cast<int*>(optval) = tcp->connection_errno_;
+    // Make sure any queued error has been delivered.
+    DispatchEvents();
+    *reinterpret_cast<int*>(optval) = stream->connection_errno_;
+    *optlen = sizeof(int);
     return 0;
   }
 
-  // No other options are currently implemented.
-  Log("POSIX::GetSockOpt(): Unsupported optname/level");
-  errno = EINVAL;
-  return -1;
+  int value;
+  if (file->GetSockOpt(level, optname, &value) != 0) {
+    Log("POSIX::GetSockOpt(): Unsupported optname/level: %d/%d", optname,
+        level);
+    return -1;
+  }
+  *reinterpret_cast<int*>(optval) = value;
+  *optlen = sizeof(int);
+  return 0;
+}
+
+int POSIX::GetPeerName(int sockfd, struct sockaddr* addr, socklen_t* addrlen) {
+  if (files_.count(sockfd) == 0 || files_[sockfd] == nullptr) {
+    errno = EBADF;
+    return -1;
+  }
+  TCP* tcp = dynamic_cast<TCP*>(files_[sockfd].get());
+  if (tcp == nullptr) {
+    Log("POSIX::GetPeerName(): Only implemented for TCP.");
+    errno = ENOTSOCK;
+    return -1;
+  }
+  pp::NetAddress address;
+  const int result = tcp->GetPeerName(&address);
+  if (result != 0) {
+    errno = result;
+    return -1;
+  }
+
+  union {
+    struct sockaddr_in in;
+    struct sockaddr_in6 in6;
+  } peer;
+  memset(&peer, 0, sizeof(peer));
+  socklen_t peer_len = 0;
+  PP_NetAddress_IPv4 ipv4_addr;
+  PP_NetAddress_IPv6 ipv6_addr;
+  if (address.DescribeAsIPv4Address(&ipv4_addr)) {
+    peer.in.sin_family = AF_INET;
+    peer.in.sin_port = ipv4_addr.port;
+    memcpy(&peer.in.sin_addr.s_addr, ipv4_addr.addr, sizeof(ipv4_addr.addr));
+    peer_len = sizeof(peer.in);
+  } else if (address.DescribeAsIPv6Address(&ipv6_addr)) {
+    peer.in6.sin6_family = AF_INET6;
+    peer.in6.sin6_port = ipv6_addr.port;
+    memcpy(peer.in6.sin6_addr.s6_addr, ipv6_addr.addr, sizeof(ipv6_addr.addr));
+    peer_len = sizeof(peer.in6);
+  } else {
+    Log("POSIX::GetPeerName(): Unsupported address family.");
+    errno = ENOTCONN;
+    return -1;
+  }
+  // Like getpeername(), truncate to the space given, but report the full size.
+  memcpy(addr, &peer, std::min(*addrlen, peer_len));
+  *addrlen = peer_len;
+  return 0;
+}
+
+int POSIX::SetSockOpt(int sockfd, int level, int optname, const void* optval,
+                      socklen_t optlen) {
+  if (files_.count(sockfd) == 0 || files_[sockfd] == nullptr) {
+    errno = EBADF;
+    return -1;
+  }
+
+  const bool supported =
+      (level == SOL_SOCKET && (optname == SO_SNDBUF || optname == SO_RCVBUF)) ||
+      (level == IPPROTO_TCP && optname == TCP_NODELAY) ||
+      (level == IPPROTO_IP && optname == IP_TOS) ||
+      (level == IPPROTO_IPV6 && optname == IPV6_TCLASS);
+  if (!supported) {
+    // Pretend to succeed, as this always has, so that callers setting
+    // options that don't matter here carry on.
+    Log("POSIX::SetSockOpt(): Ignoring optname/level: %d/%d", optname, level);
+    return 0;
+  }
+  if (optlen < sizeof(int)) {
+    errno = EINVAL;
+    return -1;
+  }
+  return files_[sockfd]->SetSockOpt(level, optname,
+                                    *reinterpret_cast<const int*>(optval));
+}
+
+namespace {
+
+// Fills in |*addr| from the numeric |address| and |port|. Returns false if
+// |address| isn't numeric.
+bool ParseNumericAddress(const string& address, uint16_t port,
+                         struct sockaddr_storage* addr, socklen_t* addrlen) {
+  memset(addr, 0, sizeof(*addr));
+  struct sockaddr_in* addr4 = reinterpret_cast<struct sockaddr_in*>(addr);
+  if (inet_pton(AF_INET, address.c_str(), &addr4->sin_addr) == 1) {
+    addr4->sin_family = AF_INET;
+    addr4->sin_port = htons(port);
+    *addrlen = sizeof(*addr4);
+    return true;
+  }
+  struct sockaddr_in6* addr6 = reinterpret_cast<struct sockaddr_in6*>(addr);
+  if (inet_pton(AF_INET6, address.c_str(), &addr6->sin6_addr) == 1) {
+    addr6->sin6_family = AF_INET6;
+    addr6->sin6_port = htons(port);
+    *addrlen = sizeof(*addr6);
+    return true;
+  }
+  return false;
+}
+
+}  // anonymous namespace
+
+int POSIX::GetAddrInfo(const char* node, const char* service,
+                       const struct addrinfo* hints, struct addrinfo** res) {
+  const struct addrinfo no_hints = {};
+  if (hints == nullptr) {
+    hints = &no_hints;
+  }
+  if (node == nullptr) {
+    Log("POSIX::GetAddrInfo(): Null node not implemented.");
+    return EAI_NONAME;
+  }
+  if (hints->ai_family != AF_UNSPEC && hints->ai_family != AF_INET &&
+      hints->ai_family != AF_INET6) {
+    return EAI_FAMILY;
+  }
+
+  uint16_t port = 0;
+  if (service != nullptr) {
+    char* end;
+    const long value = strtol(service, &end, 10);  // NOLINT(runtime/int)
+    if (*service == '\0' || *end != '\0' || value < 0 || value > 65535) {
+      Log("POSIX::GetAddrInfo(): Only numeric services are implemented.");
+      return EAI_SERVICE;
+    }
+    port = value;
+  }
+
+  vector<string> addresses;
+  struct sockaddr_storage scratch;
+  socklen_t scratch_len;
+  if (ParseNumericAddress(node, 0, &scratch, &scratch_len)) {
+    addresses.push_back(node);
+  } else if (hints->ai_flags & AI_NUMERICHOST) {
+    return EAI_NONAME;
+  } else if (resolver_ == nullptr) {
+    Log("POSIX::GetAddrInfo(): No resolver.");
+    return EAI_FAIL;
+  } else {
+    // Look up the requested family, or else the one the user chose.
+    Resolver::Type type = resolver_type_;
+    if (hints->ai_family == AF_INET) {
+      type = Resolver::Type::A;
+    } else if (hints->ai_family == AF_INET6) {
+      type = Resolver::Type::AAAA;
+    }
+    using Result = std::pair<Resolver::Error, vector<string>>;
+    std::promise<Result> promise;
+    resolver_->Resolve(node, type,
+                       [&promise](Resolver::Error error, Resolver::Authenticity,
+                                  vector<string> results) {
+                         promise.set_value(Result(error, move(results)));
+                       });
+    Result result = promise.get_future().get();
+    if (result.first == Resolver::Error::NOT_RESOLVED) {
+      return EAI_NONAME;
+    }
+    if (result.first != Resolver::Error::OK) {
+      return EAI_FAIL;
+    }
+    addresses = move(result.second);
+  }
+
+  struct addrinfo* head = nullptr;
+  struct addrinfo** tail = &head;
+  for (const auto& address : addresses) {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    if (!ParseNumericAddress(address, port, &addr, &addrlen)) {
+      Log("POSIX::GetAddrInfo(): Resolver returned bogus address '%s'.",
+          address.c_str());
+      continue;
+    }
+    if (hints->ai_family != AF_UNSPEC && hints->ai_family != addr.ss_family) {
+      continue;
+    }
+    struct addrinfo* ai = new struct addrinfo;
+    memset(ai, 0, sizeof(*ai));
+    ai->ai_family = addr.ss_family;
+    ai->ai_socktype = hints->ai_socktype;
+    ai->ai_protocol = hints->ai_protocol;
+    ai->ai_addr = reinterpret_cast<struct sockaddr*>(
+        new struct sockaddr_storage(addr));
+    ai->ai_addrlen = addrlen;
+    *tail = ai;
+    tail = &ai->ai_next;
+  }
+  if (head == nullptr) {
+    return EAI_NONAME;
+  }
+  if (hints->ai_flags & AI_CANONNAME) {
+    // The Resolvers don't report CNAMEs, so the name is as given.
+    const size_t len = strlen(node) + 1;
+    head->ai_canonname = new char[len];
+    memcpy(head->ai_canonname, node, len);
+  }
+
+  *res = head;
+  return 0;
+}
+
+void POSIX::FreeAddrInfo(struct addrinfo* res) {
+  while (res != nullptr) {
+    struct addrinfo* last = res;
+    delete reinterpret_cast<struct sockaddr_storage*>(res->ai_addr);
+    delete[] res->ai_canonname;
+    res = res->ai_next;
+    delete last;
+  }
 }
 
 }  // namespace PepperPOSIX
@@ -21,8 +21,12 @@
 #ifndef MOSH_NACL_PEPPER_POSIX_H_
 #define MOSH_NACL_PEPPER_POSIX_H_
 
+#include "mosh_nacl/pepper_posix_event_queue.h"
 #include "mosh_nacl/pepper_posix_selector.h"
+#include "mosh_nacl/pepper_posix_trace.h"
+#include "mosh_nacl/resolver.h"
 
+#include <netdb.h>
 #include <poll.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -33,16 +37,24 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "ppapi/c/ppb_net_address.h"
 #include "ppapi/cpp/instance_handle.h"
 #include "ppapi/cpp/net_address.h"
 
-// Implement this to plumb logging from Pepper functions to your app.
+// Implement these to plumb logging from Pepper functions to your app. Use
+// LogError() for failures; Log() may be rate limited. |format| must be a string
+// literal.
 void Log(const char* format, ...);
+void LogError(const char* format, ...);
 
 namespace PepperPOSIX {
 
+class IOThread;  // Declared in pepper_posix_io_thread.h.
+
 // Abstract class representing a POSIX file.
 class File {
  public:
@@ -60,12 +72,38 @@ class File {
   virtual const bool IsBlocking() { return blocking_; }
   virtual void SetBlocking(bool mode) { blocking_ = mode; }
 
+  // SetSockOpt replaces setsockopt() for int-valued options. This
+  // implementation just records |value| for GetSockOpt(); override it to apply
+  // the option, too.
+  virtual int SetSockOpt(int level, int optname, int value);
+
+  // GetSockOpt replaces getsockopt() for options set with SetSockOpt().
+  virtual int GetSockOpt(int level, int optname, int* value);
+
  protected:
   friend class POSIX;
+
+  // PostEvent queues |event| for HandleEvent(). It can be called from any
+  // thread, and is how data arriving in callbacks should reach the File.
+  void PostEvent(Event event) {
+    event.fd = fd();
+    event.serial = serial_;
+    events_->Push(std::move(event));
+  }
+
+  // HandleEvent receives the events from PostEvent(), in order. It is called
+  // on the thread using POSIX, which is the same one that calls the other
+  // methods, so no locking is needed.
+  virtual void HandleEvent(__attribute__((unused)) Event event) {}
+
   std::unique_ptr<Target> target_;
 
  private:
   bool blocking_ = true;
+  EventQueue* events_ = nullptr;
+  uint32_t serial_ = 0;
+  // Values set with SetSockOpt(), keyed by level and optname.
+  std::map<std::pair<int, int>, int> options_;
 
   // Disable copy and assignment.
   File(const File&) = delete;
@@ -113,7 +151,7 @@ class POSIX {
         std::unique_ptr<Reader> std_in, std::unique_ptr<Writer> std_out,
         std::unique_ptr<Writer> std_err, std::unique_ptr<Signal> signal);
 
-  ~POSIX(){};
+  ~POSIX();
 
   int Open(const char* pathname, int flags, mode_t mode);
 
@@ -151,6 +189,53 @@ class POSIX {
   int GetSockOpt(int sockfd, int level, int optname, void* optval,
                  socklen_t* optlen);
 
+  // GetPeerName replaces getpeername(). Only TCP sockets are supported.
+  int GetPeerName(int sockfd, struct sockaddr* addr, socklen_t* addrlen);
+
+  int SetSockOpt(int sockfd, int level, int optname, const void* optval,
+                 socklen_t optlen);
+
+  // GetAddrInfo replaces getaddrinfo(). Names are looked up with the Resolver
+  // from SetResolver(), which blocks, so this must not be called on the main
+  // thread. Unlike getaddrinfo(), AF_UNSPEC does not give both address
+  // families, only the one set with SetResolver(). Free the results with
+  // FreeAddrInfo().
+  int GetAddrInfo(const char* node, const char* service,
+                  const struct addrinfo* hints, struct addrinfo** res);
+
+  // FreeAddrInfo replaces freeaddrinfo().
+  static void FreeAddrInfo(struct addrinfo* res);
+
+  // Sets the Resolver for GetAddrInfo(), and the |type| of address that
+  // AF_UNSPEC looks up: the family chosen by the user. Does not take
+  // ownership.
+  void SetResolver(Resolver* resolver, Resolver::Type type) {
+    resolver_ = resolver;
+    resolver_type_ = type;
+  }
+
+  // Records inbound events and outbound writes to |trace|, or stops if it is
+  // nullptr. Does not take ownership.
+  void SetTrace(IOTrace* trace) { trace_ = trace; }
+
+  // Chooses whether Pepper socket operations and their completions run on a
+  // dedicated I/O thread (if |enabled|) or on the main thread. Only affects
+  // sockets created afterwards.
+  void SetIOThread(bool enabled);
+
+  // The I/O thread, or nullptr if disabled. Socket factories pass this to the
+  // Files they make.
+  IOThread* io_thread() { return io_thread_.get(); }
+  const IOThread* io_thread() const { return io_thread_.get(); }
+
+  // Queueing delay statistics for inbound events. Only read these from the
+  // thread using POSIX.
+  const EventQueue::Stats& event_stats() const { return events_.stats(); }
+
+  // Enables adaptive spinning in Select()-style calls; see
+  // Selector::SetAdaptiveSpin().
+  void SetAdaptiveSpin(bool enabled) { selector_.SetAdaptiveSpin(enabled); }
+
   // Register a filename and File factory to be used when that file is
   // opened.
   void RegisterFile(std::string filename,
@@ -158,17 +243,32 @@ class POSIX {
     factories_[filename] = factory;
   }
 
-  // Register a File factory to be called every time a Unix domain socket of
-  // type SOCK_STREAM is created by calling Socket().
-  void RegisterUnixSocketStream(
-      std::function<std::unique_ptr<File>()> factory) {
-    unix_socket_stream_factory_ = factory;
+  // Register a File factory to be called every time Socket() is called with
+  // exactly this |domain|, |type|, and |protocol|. Replaces any factory already
+  // registered for them, including the defaults: NativeUDP and NativeTCP for
+  // AF_INET and AF_INET6, with protocol 0 or the one named.
+  void RegisterSocket(int domain, int type, int protocol,
+                      std::function<std::unique_ptr<File>()> factory) {
+    socket_factories_[std::make_tuple(domain, type, protocol)] = factory;
   }
 
  private:
   // Returns the next available file descriptor.
   int NextFileDescriptor();
 
+  // Connects |file| to the Selector and event queue as |fd|.
+  void Register(File* file, int fd);
+
+  // Delivers all queued events to their Files.
+  void DispatchEvents();
+
+  // Wait is Selector::Select() for the POSIX calls. It also watches the event
+  // queue, delivering events as they arrive, and returns only targets that
+  // are ready (or none, if |timeout| passes).
+  std::vector<Target*> Wait(std::vector<Target*> read_targets,
+                            const std::vector<Target*>& write_targets,
+                            const struct timespec* timeout);
+
   // Makes a pp::NetAddress from a sockaddr.
   pp::NetAddress MakeAddress(const struct sockaddr* addr,
                              socklen_t addrlen) const;
@@ -177,11 +277,21 @@ class POSIX {
   std::map<int, std::unique_ptr<File>> files_;
   // Map of registered files and their File factories.
   std::map<std::string, std::function<std::unique_ptr<File>()>> factories_;
-  // Factory function for creating Unix domain sockets of type SOCK_STREAM.
-  std::function<std::unique_ptr<File>()> unix_socket_stream_factory_;
+  // Map of (domain, type, protocol) and their socket File factories.
+  std::map<std::tuple<int, int, int>, std::function<std::unique_ptr<File>()>>
+      socket_factories_;
   std::unique_ptr<Signal> signal_;
   Selector selector_;
+  // All inbound events, delivered by DispatchEvents(). |event_batch_| is kept
+  // only to reuse its storage.
+  EventQueue events_;
+  std::vector<Event> event_batch_;
+  uint32_t next_serial_ = 0;
   const pp::InstanceHandle instance_handle_;
+  std::unique_ptr<IOThread> io_thread_;
+  Resolver* resolver_ = nullptr;  // Not owned.
+  IOTrace* trace_ = nullptr;       // Not owned.
+  Resolver::Type resolver_type_ = Resolver::Type::A;
 
   // Disable copy and assignment.
   POSIX(const POSIX&) = delete;
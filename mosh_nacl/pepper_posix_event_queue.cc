@@ -0,0 +1,75 @@
+// pepper_posix_event_queue.cc - Inbound event queue for Pepper POSIX adapters.
+//
+// Pepper POSIX is a set of adapters to enable POSIX-like APIs to work with the
+// callback-based APIs of Pepper (and transitively, JavaScript).
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/pepper_posix_event_queue.h"
+
+#include <utility>
+
+namespace PepperPOSIX {
+
+using std::move;
+using std::vector;
+
+EventQueue::EventQueue(Selector& selector, int id)
+    : target_(selector.NewTarget(id)) {
+  // The queue itself is never written to through the Selector.
+  target_->UpdateWrite(false);
+}
+
+EventQueue::~EventQueue() {}
+
+void EventQueue::Push(Event event) {
+  clock_gettime(CLOCK_MONOTONIC, &event.enqueued);
+  pthread::MutexLock m(pending_lock_);
+  pending_.push_back(move(event));
+  if (pending_.size() == 1) {
+    // Only the first event of a batch needs to wake the consumer.
+    target_->UpdateRead(true);
+  }
+}
+
+void EventQueue::Take(vector<Event>* batch) {
+  batch->clear();
+  {
+    pthread::MutexLock m(pending_lock_);
+    if (pending_.size() == 0) {
+      return;
+    }
+    // |batch| keeps its capacity, so it becomes the next pending buffer.
+    pending_.swap(*batch);
+    target_->UpdateRead(false);
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (const auto& event : *batch) {
+    const int64_t delay_us =
+        (now.tv_sec - event.enqueued.tv_sec) * 1000000LL +
+        (now.tv_nsec - event.enqueued.tv_nsec) / 1000;
+    stats_.total_delay_us += delay_us;
+    if (delay_us > stats_.max_delay_us) {
+      stats_.max_delay_us = delay_us;
+    }
+  }
+  ++stats_.batches;
+  stats_.events += batch->size();
+}
+
+}  // namespace PepperPOSIX
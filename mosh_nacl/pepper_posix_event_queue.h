@@ -0,0 +1,112 @@
+// pepper_posix_event_queue.h - Inbound event queue for Pepper POSIX adapters.
+//
+// Pepper POSIX is a set of adapters to enable POSIX-like APIs to work with the
+// callback-based APIs of Pepper (and transitively, JavaScript).
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MOSH_NACL_PEPPER_POSIX_EVENT_QUEUE_H_
+#define MOSH_NACL_PEPPER_POSIX_EVENT_QUEUE_H_
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <memory>
+#include <vector>
+
+#include "mosh_nacl/pepper_posix_selector.h"
+#include "mosh_nacl/pthread_locks.h"
+
+namespace PepperPOSIX {
+
+// Event is inbound data for a File, such as a received packet or keypresses.
+// It carries the data from the thread that produced it (usually the Pepper
+// main thread) to the thread using POSIX.
+struct Event {
+  Event() : enqueued({0, 0}) { memset(&address, 0, sizeof(address)); }
+
+  // Identifies the File. |serial| tells apart Files that reused an fd.
+  int fd = -1;
+  uint32_t serial = 0;
+
+  std::vector<char> data;
+
+  // For streams: an errno-style error, or the end of the data, after |data|.
+  int error = 0;
+  bool eof = false;
+
+  // Source address of a datagram; |address_len| is 0 if there is none.
+  union {
+    struct sockaddr sa;
+    struct sockaddr_in in;
+    struct sockaddr_in6 in6;
+  } address;
+  socklen_t address_len = 0;
+
+  // When the Event was queued, on CLOCK_MONOTONIC. Set by EventQueue::Push().
+  struct timespec enqueued;
+};
+
+// EventQueue is a multiple-producer, single-consumer queue of Events. Any
+// thread can Push(); one thread at a time Take()s everything pending as a
+// batch. Its Target is readable while events are pending, and only the Push()
+// onto an empty queue notifies the Selector, so a burst of callbacks costs one
+// wakeup.
+//
+// Two buffers are swapped between producers and the consumer, so once warmed
+// up, queueing an event allocates nothing; each Event's |data| is still its
+// own allocation, made by whoever builds the Event.
+class EventQueue {
+ public:
+  // Counters for measuring queueing delay, which is the time between Push()
+  // and Take(). Only updated by Take(), so only read them from its thread.
+  struct Stats {
+    uint64_t batches = 0;
+    uint64_t events = 0;
+    uint64_t total_delay_us = 0;
+    uint32_t max_delay_us = 0;
+  };
+
+  // Registers a Target with |selector| under the opaque |id|.
+  EventQueue(Selector& selector, int id);
+  ~EventQueue();
+
+  // Queues |event|. Can be called from any thread.
+  void Push(Event event);
+
+  // Replaces the contents of |*batch| with all pending events, in the order
+  // they were pushed. Pass the same vector every time to reuse its storage.
+  void Take(std::vector<Event>* batch);
+
+  Target* target() { return target_.get(); }
+  const Stats& stats() const { return stats_; }
+
+ private:
+  std::unique_ptr<Target> target_;
+  std::vector<Event> pending_;  // Guard with pending_lock_.
+  pthread::Mutex pending_lock_;
+  Stats stats_;
+
+  // Disable copy and assignment.
+  EventQueue(const EventQueue&) = delete;
+  EventQueue& operator=(const EventQueue&) = delete;
+};
+
+}  // namespace PepperPOSIX
+
+#endif  // MOSH_NACL_PEPPER_POSIX_EVENT_QUEUE_H_
@@ -0,0 +1,132 @@
+// pepper_posix_event_queue_test.cc - Tests for pepper_posix_event_queue.{h,cc}.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/pepper_posix_event_queue.h"
+
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::move;
+using std::vector;
+
+namespace PepperPOSIX {
+
+class EventQueueTest : public ::testing::Test {
+ protected:
+  EventQueueTest() : queue_(selector_, -1) {}
+
+  Event MakeEvent(int fd, char value) {
+    Event event;
+    event.fd = fd;
+    event.data.push_back(value);
+    return event;
+  }
+
+  Selector selector_;
+  EventQueue queue_;
+};
+
+TEST_F(EventQueueTest, EmptyTake) {
+  vector<Event> batch;
+  queue_.Take(&batch);
+  EXPECT_EQ(0, batch.size());
+  EXPECT_FALSE(queue_.target()->has_read_data());
+  EXPECT_EQ(0, queue_.stats().batches);
+}
+
+TEST_F(EventQueueTest, OneWakeupPerBatch) {
+  const uint32_t before = selector_.sequence();
+  queue_.Push(MakeEvent(1, 'a'));
+  EXPECT_TRUE(queue_.target()->has_read_data());
+  const uint32_t after_first = selector_.sequence();
+  EXPECT_NE(before, after_first);
+  queue_.Push(MakeEvent(2, 'b'));
+  queue_.Push(MakeEvent(1, 'c'));
+  EXPECT_EQ(after_first, selector_.sequence());
+
+  vector<Event> batch;
+  queue_.Take(&batch);
+  ASSERT_EQ(3, batch.size());
+  EXPECT_EQ('a', batch[0].data[0]);
+  EXPECT_EQ(2, batch[1].fd);
+  EXPECT_EQ('c', batch[2].data[0]);
+  EXPECT_FALSE(queue_.target()->has_read_data());
+  EXPECT_EQ(1, queue_.stats().batches);
+  EXPECT_EQ(3, queue_.stats().events);
+
+  // The next batch wakes the consumer again.
+  queue_.Push(MakeEvent(1, 'd'));
+  EXPECT_NE(after_first, selector_.sequence());
+}
+
+// Several producers push while the consumer selects and takes batches. Every
+// event must arrive once, in order per producer.
+TEST_F(EventQueueTest, ManyProducers) {
+  const int kProducers = 4;
+  const int kEvents = 10000;
+  vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([this, p]() {
+      for (int i = 0; i < kEvents; ++i) {
+        Event event;
+        event.fd = p;
+        event.serial = i;
+        queue_.Push(move(event));
+      }
+    });
+  }
+
+  vector<int> next(kProducers, 0);
+  int received = 0;
+  vector<Target*> read_targets(1, queue_.target());
+  const vector<Target*> no_targets;
+  vector<Event> batch;
+  const struct timespec timeout = {5, 0};
+  // Failures stop the loop rather than returning, so that the producers are
+  // always joined.
+  bool failed = false;
+  while (!failed && received < kProducers * kEvents) {
+    const size_t ready =
+        selector_.Select(read_targets, no_targets, &timeout).size();
+    EXPECT_EQ(1, ready);
+    if (ready != 1) {
+      failed = true;
+      break;
+    }
+    queue_.Take(&batch);
+    for (const auto& event : batch) {
+      EXPECT_EQ(next[event.fd], event.serial);
+      if (next[event.fd] != event.serial) {
+        failed = true;
+        break;
+      }
+      ++next[event.fd];
+    }
+    received += batch.size();
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  ASSERT_FALSE(failed);
+  EXPECT_EQ(kProducers * kEvents, queue_.stats().events);
+  EXPECT_LE(queue_.stats().batches, queue_.stats().events);
+}
+
+}  // namespace PepperPOSIX
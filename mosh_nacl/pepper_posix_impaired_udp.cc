@@ -0,0 +1,168 @@
+// pepper_posix_impaired_udp.cc - UDP over a simulated bad network.
+//
+// Pepper POSIX is a set of adapters to enable POSIX-like APIs to work with the
+// callback-based APIs of Pepper (and transitively, JavaScript).
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/pepper_posix_impaired_udp.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <utility>
+
+namespace PepperPOSIX {
+
+using std::move;
+using std::unique_ptr;
+
+namespace {
+
+int64_t NowMicroseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+}  // anonymous namespace
+
+ImpairedUDP::ImpairedUDP(unique_ptr<UDP> udp,
+                         const Impairment::Config& outbound,
+                         const Impairment::Config& inbound)
+    : udp_(move(udp)), outbound_(outbound), inbound_(inbound) {
+  udp_->SetPacketSink([this](Event event) { Received(move(event)); });
+  int thread_err = pthread_create(&thread_, nullptr, Run, this);
+  if (thread_err != 0) {
+    Log("ImpairedUDP: Failed to create thread: %s", strerror(thread_err));
+    return;
+  }
+  running_ = true;
+}
+
+ImpairedUDP::~ImpairedUDP() { Close(); }
+
+int ImpairedUDP::Bind(const pp::NetAddress& address) {
+  return udp_->Bind(address);
+}
+
+ssize_t ImpairedUDP::Send(const void* buf, size_t count, int flags,
+                          const pp::NetAddress& address) {
+  if (!running_) {
+    errno = EIO;
+    return -1;
+  }
+  Held held;
+  held.outbound = true;
+  const char* cbuf = static_cast<const char*>(buf);
+  held.event.data.assign(cbuf, cbuf + count);
+  held.address = address;
+  held.flags = flags;
+
+  pthread::MutexLock m(held_lock_);
+  Hold(outbound_.Schedule(NowMicroseconds(), count), move(held));
+  return count;
+}
+
+// Received takes packets from |udp_|, on whatever thread it receives them.
+void ImpairedUDP::Received(Event event) {
+  const size_t size = event.data.size();
+  Held held;
+  held.outbound = false;
+  held.event = move(event);
+  held.flags = 0;
+
+  pthread::MutexLock m(held_lock_);
+  Hold(inbound_.Schedule(NowMicroseconds(), size), move(held));
+}
+
+// Call with held_lock_ held.
+void ImpairedUDP::Hold(int64_t due_us, Held held) {
+  if (due_us < 0 || quit_) {
+    return;
+  }
+  const bool sooner = held_.empty() || due_us < held_.begin()->first;
+  held_.emplace(due_us, move(held));
+  if (sooner) {
+    held_cv_.Signal();
+  }
+}
+
+int ImpairedUDP::Close() {
+  {
+    pthread::MutexLock m(held_lock_);
+    if (quit_) {
+      return 0;
+    }
+    quit_ = true;
+    held_.clear();
+    held_cv_.Signal();
+  }
+  if (running_) {
+    pthread_join(thread_, nullptr);
+    running_ = false;
+  }
+  return udp_->Close();
+}
+
+int ImpairedUDP::SetSockOpt(int level, int optname, int value) {
+  return udp_->SetSockOpt(level, optname, value);
+}
+
+int ImpairedUDP::GetSockOpt(int level, int optname, int* value) {
+  return udp_->GetSockOpt(level, optname, value);
+}
+
+void* ImpairedUDP::Run(void* data) {
+  reinterpret_cast<ImpairedUDP*>(data)->Run();
+  return nullptr;
+}
+
+// Run sends and delivers held packets as they come due, until Close().
+void ImpairedUDP::Run() {
+  pthread::MutexLock m(held_lock_);
+  while (!quit_) {
+    if (held_.empty()) {
+      held_cv_.Wait(&held_lock_);
+      continue;
+    }
+    const int64_t wait_us = held_.begin()->first - NowMicroseconds();
+    if (wait_us > 0) {
+      struct timespec abstime;
+      clock_gettime(CLOCK_REALTIME, &abstime);
+      const int64_t nsec = abstime.tv_nsec + (wait_us % 1000000) * 1000;
+      abstime.tv_sec += wait_us / 1000000 + nsec / 1000000000;
+      abstime.tv_nsec = nsec % 1000000000;
+      held_cv_.TimedWait(&held_lock_, abstime);
+      continue;
+    }
+
+    Held held = move(held_.begin()->second);
+    held_.erase(held_.begin());
+    held_lock_.Unlock();
+    if (held.outbound) {
+      if (udp_->Send(held.event.data.data(), held.event.data.size(),
+                     held.flags, held.address) < 0) {
+        Log("ImpairedUDP::Run(): Send failed: %d", errno);
+      }
+    } else {
+      DeliverPacket(move(held.event));
+    }
+    held_lock_.Lock();
+  }
+}
+
+}  // namespace PepperPOSIX
@@ -0,0 +1,102 @@
+// pepper_posix_impaired_udp.h - UDP over a simulated bad network.
+//
+// Pepper POSIX is a set of adapters to enable POSIX-like APIs to work with the
+// callback-based APIs of Pepper (and transitively, JavaScript).
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MOSH_NACL_PEPPER_POSIX_IMPAIRED_UDP_H_
+#define MOSH_NACL_PEPPER_POSIX_IMPAIRED_UDP_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "mosh_nacl/pepper_posix_event_queue.h"
+#include "mosh_nacl/pepper_posix_impairment.h"
+#include "mosh_nacl/pepper_posix_udp.h"
+#include "mosh_nacl/pthread_locks.h"
+
+#include "ppapi/cpp/net_address.h"
+
+namespace PepperPOSIX {
+
+// ImpairedUDP wraps another UDP implementation, and passes its traffic
+// through an Impairment in each direction, to see how Mosh copes with lossy,
+// laggy links. Delayed packets are held by a thread of its own, which sends
+// or delivers each one when it is due.
+//
+// The wrapped UDP must not be registered with POSIX; ImpairedUDP takes its
+// received packets with SetPacketSink().
+class ImpairedUDP : public UDP {
+ public:
+  ImpairedUDP(std::unique_ptr<UDP> udp, const Impairment::Config& outbound,
+              const Impairment::Config& inbound);
+  ~ImpairedUDP() override;
+
+  // Bind replaces bind().
+  int Bind(const pp::NetAddress& address) override;
+
+  // Send replaces sendto. Usage is similar, but tweaked for C++. Lost packets
+  // are reported as sent, as they would be by a real network.
+  ssize_t Send(const void* buf, size_t count, int flags,
+               const pp::NetAddress& address) override;
+
+  // Close replaces close(). Packets still held are discarded.
+  int Close() override;
+
+  int SetSockOpt(int level, int optname, int value) override;
+  int GetSockOpt(int level, int optname, int* value) override;
+
+ private:
+  // A packet held until it is due. Inbound packets are already Events;
+  // outbound ones also need their destination and flags.
+  struct Held {
+    bool outbound;
+    Event event;
+    pp::NetAddress address;
+    int flags;
+  };
+
+  // Holds |held| until |due_us|, or drops it if |due_us| is negative.
+  void Hold(int64_t due_us, Held held);
+  void Received(Event event);
+
+  static void* Run(void* data);
+  void Run();
+
+  std::unique_ptr<UDP> udp_;
+  // Guard all of these with held_lock_.
+  Impairment outbound_;
+  Impairment inbound_;
+  std::multimap<int64_t, Held> held_;  // Keyed by when each is due.
+  bool quit_ = false;
+  pthread::Mutex held_lock_;
+  pthread::Conditional held_cv_;
+
+  pthread_t thread_;
+  bool running_ = false;
+
+  // Disable copy and assignment.
+  ImpairedUDP(const ImpairedUDP&) = delete;
+  ImpairedUDP& operator=(const ImpairedUDP&) = delete;
+};
+
+}  // namespace PepperPOSIX
+
+#endif  // MOSH_NACL_PEPPER_POSIX_IMPAIRED_UDP_H_
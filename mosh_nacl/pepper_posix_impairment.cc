@@ -0,0 +1,106 @@
+// pepper_posix_impairment.cc - Network impairment model.
+//
+// Pepper POSIX is a set of adapters to enable POSIX-like APIs to work with the
+// callback-based APIs of Pepper (and transitively, JavaScript).
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/pepper_posix_impairment.h"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <sstream>
+
+using std::max;
+using std::string;
+
+namespace PepperPOSIX {
+
+bool Impairment::Config::Parse(const string& spec) {
+  std::istringstream items(spec);
+  string item;
+  while (getline(items, item, ',')) {
+    const size_t equals = item.find('=');
+    if (equals == string::npos) {
+      return false;
+    }
+    const string name = item.substr(0, equals);
+    const string value = item.substr(equals + 1);
+    char* end;
+    const double number = strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || number < 0) {
+      return false;
+    }
+    if (name == "delay") {
+      delay_ms = number;
+    } else if (name == "jitter") {
+      jitter_ms = number;
+    } else if (name == "loss") {
+      loss = number;
+    } else if (name == "reorder") {
+      reorder = number;
+    } else if (name == "rate") {
+      rate_bps = number;
+    } else if (name == "seed") {
+      seed = number;
+    } else {
+      return false;
+    }
+  }
+  return loss <= 1.0 && reorder <= 1.0;
+}
+
+Impairment::Impairment(const Config& config)
+    : config_(config), rng_(config.seed) {}
+
+double Impairment::Random() {
+  // Not std::uniform_real_distribution, whose output varies between library
+  // implementations; a seed should mean the same run everywhere.
+  return rng_() / (static_cast<double>(rng_.max()) + 1.0);
+}
+
+int64_t Impairment::Schedule(int64_t now_us, size_t bytes) {
+  // Draw every number for every packet, so that changing one setting doesn't
+  // change the fate of later packets under the others.
+  const double loss_draw = Random();
+  const double jitter_draw = Random();
+  const double reorder_draw = Random();
+
+  if (loss_draw < config_.loss) {
+    return -1;
+  }
+
+  // Lost packets never reach the link, so they don't use its bandwidth.
+  int64_t sent_us = now_us;
+  if (config_.rate_bps > 0) {
+    sent_us = max(now_us, link_free_us_) +
+              static_cast<int64_t>(bytes) * 8 * 1000000 / config_.rate_bps;
+    link_free_us_ = sent_us;
+  }
+
+  if (reorder_draw < config_.reorder) {
+    return sent_us;
+  }
+  int64_t delay_us = config_.delay_ms * 1000LL;
+  delay_us += static_cast<int64_t>((jitter_draw * 2 - 1) * config_.jitter_ms *
+                                   1000);
+  const int64_t arrival_us =
+      max(sent_us + max(delay_us, int64_t{0}), last_arrival_us_);
+  last_arrival_us_ = arrival_us;
+  return arrival_us;
+}
+
+}  // namespace PepperPOSIX
@@ -0,0 +1,79 @@
+// pepper_posix_impairment.h - Network impairment model.
+//
+// Pepper POSIX is a set of adapters to enable POSIX-like APIs to work with the
+// callback-based APIs of Pepper (and transitively, JavaScript).
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MOSH_NACL_PEPPER_POSIX_IMPAIRMENT_H_
+#define MOSH_NACL_PEPPER_POSIX_IMPAIRMENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <random>
+#include <string>
+
+namespace PepperPOSIX {
+
+// Impairment decides the fate of each packet sent over a simulated bad link:
+// whether it is lost, and if not, when it arrives. It only does the
+// arithmetic; ImpairedUDP does the delaying. Decisions come from a seeded
+// RNG, so a run can be repeated exactly.
+//
+// Packets are serialized at |rate_bps|, then delayed by |delay_ms| plus or
+// minus up to |jitter_ms|. Arrivals stay in order unless the packet is one of
+// the |reorder| fraction, which skip the delay and so overtake those queued.
+class Impairment {
+ public:
+  struct Config {
+    int delay_ms = 0;
+    int jitter_ms = 0;
+    double loss = 0.0;     // Fraction of packets dropped.
+    double reorder = 0.0;  // Fraction of packets sent without delay.
+    int64_t rate_bps = 0;  // Zero for unlimited.
+    uint32_t seed = 1;
+
+    // Parses a comma-separated list of name=value pairs, with the names
+    // "delay", "jitter", "loss", "reorder", "rate", and "seed"; for example,
+    // "delay=150,jitter=30,loss=0.02". Returns false if |spec| is malformed.
+    bool Parse(const std::string& spec);
+
+    // Whether this changes anything at all.
+    bool IsNull() const {
+      return delay_ms == 0 && jitter_ms == 0 && loss == 0.0 &&
+             reorder == 0.0 && rate_bps == 0;
+    }
+  };
+
+  explicit Impairment(const Config& config);
+
+  // Schedules a packet of |bytes| sent at |now_us|. Returns when it arrives,
+  // in the same microseconds, or -1 if it is lost.
+  int64_t Schedule(int64_t now_us, size_t bytes);
+
+ private:
+  // Returns a number in [0, 1).
+  double Random();
+
+  const Config config_;
+  std::mt19937 rng_;
+  int64_t link_free_us_ = 0;  // When the last packet finishes serializing.
+  int64_t last_arrival_us_ = 0;
+};
+
+}  // namespace PepperPOSIX
+
+#endif  // MOSH_NACL_PEPPER_POSIX_IMPAIRMENT_H_
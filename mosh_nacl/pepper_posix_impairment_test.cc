@@ -0,0 +1,126 @@
+// pepper_posix_impairment_test.cc - Tests for pepper_posix_impairment.{h,cc}.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/pepper_posix_impairment.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::vector;
+
+namespace PepperPOSIX {
+
+TEST(ImpairmentTest, ParseConfig) {
+  Impairment::Config config;
+  ASSERT_TRUE(config.Parse("delay=150,jitter=30,loss=0.02,rate=1000000"));
+  EXPECT_EQ(150, config.delay_ms);
+  EXPECT_EQ(30, config.jitter_ms);
+  EXPECT_DOUBLE_EQ(0.02, config.loss);
+  EXPECT_EQ(1000000, config.rate_bps);
+  EXPECT_FALSE(config.IsNull());
+
+  EXPECT_TRUE(Impairment::Config().Parse(""));
+  EXPECT_TRUE(Impairment::Config().IsNull());
+  EXPECT_FALSE(Impairment::Config().Parse("delay"));
+  EXPECT_FALSE(Impairment::Config().Parse("delay=fast"));
+  EXPECT_FALSE(Impairment::Config().Parse("loss=2"));
+  EXPECT_FALSE(Impairment::Config().Parse("latency=5"));
+}
+
+TEST(ImpairmentTest, NullConfigPassesThrough) {
+  Impairment impairment((Impairment::Config()));
+  for (int64_t now = 0; now < 1000; now += 10) {
+    EXPECT_EQ(now, impairment.Schedule(now, 1400));
+  }
+}
+
+TEST(ImpairmentTest, SameSeedSameRun) {
+  Impairment::Config config;
+  ASSERT_TRUE(config.Parse("delay=50,jitter=20,loss=0.1,reorder=0.1,seed=7"));
+  Impairment a(config);
+  Impairment b(config);
+  config.seed = 8;
+  Impairment c(config);
+  bool differs = false;
+  for (int i = 0; i < 1000; ++i) {
+    const int64_t arrival = a.Schedule(i * 1000, 100);
+    EXPECT_EQ(arrival, b.Schedule(i * 1000, 100));
+    differs |= arrival != c.Schedule(i * 1000, 100);
+  }
+  EXPECT_TRUE(differs);
+}
+
+TEST(ImpairmentTest, LossRate) {
+  Impairment::Config config;
+  config.loss = 0.25;
+  Impairment impairment(config);
+  int lost = 0;
+  const int kPackets = 10000;
+  for (int i = 0; i < kPackets; ++i) {
+    lost += impairment.Schedule(i, 100) < 0;
+  }
+  EXPECT_NEAR(kPackets / 4, lost, kPackets / 50);
+}
+
+TEST(ImpairmentTest, JitterKeepsOrder) {
+  Impairment::Config config;
+  config.delay_ms = 100;
+  config.jitter_ms = 50;
+  Impairment impairment(config);
+  int64_t last = 0;
+  for (int64_t now = 0; now < 1000000; now += 1000) {
+    const int64_t arrival = impairment.Schedule(now, 100);
+    EXPECT_GE(arrival, now + 50000);
+    EXPECT_LE(arrival, now + 150000 + 1000);
+    EXPECT_GE(arrival, last);
+    last = arrival;
+  }
+}
+
+TEST(ImpairmentTest, ReorderOvertakes) {
+  Impairment::Config config;
+  config.delay_ms = 100;
+  config.reorder = 0.5;
+  Impairment impairment(config);
+  int overtaken = 0;
+  int64_t latest = 0;
+  for (int64_t now = 0; now < 100000; now += 1000) {
+    const int64_t arrival = impairment.Schedule(now, 100);
+    overtaken += arrival < latest;
+    latest = std::max(latest, arrival);
+  }
+  EXPECT_GT(overtaken, 0);
+}
+
+TEST(ImpairmentTest, RateSpacesPackets) {
+  Impairment::Config config;
+  config.rate_bps = 8000;  // 1 byte per millisecond.
+  Impairment impairment(config);
+  vector<int64_t> arrivals;
+  for (int i = 0; i < 3; ++i) {
+    arrivals.push_back(impairment.Schedule(0, 100));
+  }
+  EXPECT_EQ(100000, arrivals[0]);
+  EXPECT_EQ(200000, arrivals[1]);
+  EXPECT_EQ(300000, arrivals[2]);
+  // An idle link starts sending at once.
+  EXPECT_EQ(1100000, impairment.Schedule(1000000, 100));
+}
+
+}  // namespace PepperPOSIX
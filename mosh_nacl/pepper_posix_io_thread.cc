@@ -0,0 +1,146 @@
+// pepper_posix_io_thread.cc - I/O worker thread for Pepper POSIX adapters.
+//
+// Pepper POSIX is a set of adapters to enable POSIX-like APIs to work with the
+// callback-based APIs of Pepper (and transitively, JavaScript).
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/pepper_posix_io_thread.h"
+
+#include <string.h>
+
+#include "mosh_nacl/pepper_posix.h"
+
+#include "ppapi/c/pp_errors.h"
+#include "ppapi/cpp/module.h"
+
+namespace PepperPOSIX {
+
+namespace {
+
+int64_t MicrosecondsBetween(const struct timespec& start,
+                            const struct timespec& end) {
+  return (end.tv_sec - start.tv_sec) * 1000000LL +
+         (end.tv_nsec - start.tv_nsec) / 1000;
+}
+
+}  // anonymous namespace
+
+IOThread::IOThread(const pp::InstanceHandle& instance_handle)
+    : loop_(instance_handle), factory_(this) {}
+
+IOThread::~IOThread() {
+  if (running_) {
+    loop_.PostQuit(true);
+    pthread_join(thread_, nullptr);
+  }
+}
+
+bool IOThread::Start() {
+  if (running_) {
+    return true;
+  }
+  attached_ = std::promise<int32_t>();
+  int thread_err = pthread_create(&thread_, nullptr, Run, this);
+  if (thread_err != 0) {
+    Log("IOThread::Start(): Failed to create thread: %s",
+        strerror(thread_err));
+    return false;
+  }
+  // Work posted to a loop that never attached would never run.
+  const int32_t result = attached_.get_future().get();
+  if (result != PP_OK) {
+    Log("IOThread::Start(): AttachToCurrentThread() returned %d", result);
+    pthread_join(thread_, nullptr);
+    return false;
+  }
+  running_ = true;
+  return true;
+}
+
+void* IOThread::Run(void* data) {
+  IOThread* const thiz = reinterpret_cast<IOThread*>(data);
+  int32_t result = thiz->loop_.AttachToCurrentThread();
+  thiz->attached_.set_value(result);
+  if (result != PP_OK) {
+    return nullptr;
+  }
+  result = thiz->loop_.Run();
+  if (result != PP_OK) {
+    Log("IOThread::Run(): Run() returned %d", result);
+  }
+  return nullptr;
+}
+
+void IOThread::Post(IOThread* thread, const pp::CompletionCallback& callback) {
+  if (thread == nullptr || !thread->running_) {
+    pp::Module::Get()->core()->CallOnMainThread(0, callback);
+    return;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  int32_t result = thread->loop_.PostWork(
+      thread->factory_.NewCallback(&IOThread::RunTask, callback, now));
+  if (result != PP_OK) {
+    Log("IOThread::Post(): PostWork() returned %d; using main thread.",
+        result);
+    pp::Module::Get()->core()->CallOnMainThread(0, callback);
+  }
+}
+
+void IOThread::RunTask(int32_t result, const pp::CompletionCallback& callback,
+                       const struct timespec& posted) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pp::CompletionCallback work = callback;
+  work.Run(result);
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  const int64_t delay_us = MicrosecondsBetween(posted, start);
+  pthread::MutexLock m(stats_lock_);
+  ++stats_.tasks;
+  stats_.total_delay_us += delay_us;
+  if (delay_us > stats_.max_delay_us) {
+    stats_.max_delay_us = delay_us;
+  }
+  stats_.busy_us += MicrosecondsBetween(start, end);
+}
+
+IOThread::CompletionTimer::CompletionTimer(IOThread* thread)
+    : thread_(thread) {
+  if (thread_ != nullptr) {
+    clock_gettime(CLOCK_MONOTONIC, &start_);
+  }
+}
+
+IOThread::CompletionTimer::~CompletionTimer() {
+  if (thread_ == nullptr) {
+    return;
+  }
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  pthread::MutexLock m(thread_->stats_lock_);
+  ++thread_->stats_.completions;
+  thread_->stats_.completion_busy_us += MicrosecondsBetween(start_, end);
+}
+
+IOThread::Stats IOThread::stats() const {
+  pthread::MutexLock m(stats_lock_);
+  return stats_;
+}
+
+}  // namespace PepperPOSIX
@@ -0,0 +1,106 @@
+// pepper_posix_io_thread.h - I/O worker thread for Pepper POSIX adapters.
+//
+// Pepper POSIX is a set of adapters to enable POSIX-like APIs to work with the
+// callback-based APIs of Pepper (and transitively, JavaScript).
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MOSH_NACL_PEPPER_POSIX_IO_THREAD_H_
+#define MOSH_NACL_PEPPER_POSIX_IO_THREAD_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <future>  // NOLINT(build/c++11)
+
+#include "mosh_nacl/pthread_locks.h"
+
+#include "ppapi/cpp/completion_callback.h"
+#include "ppapi/cpp/instance_handle.h"
+#include "ppapi/cpp/message_loop.h"
+#include "ppapi/utility/completion_callback_factory.h"
+
+namespace PepperPOSIX {
+
+// IOThread runs a pp::MessageLoop on its own thread. A Pepper completion
+// callback runs on the thread that started the operation, so socket
+// operations started from work posted here complete here too, instead of
+// waiting behind JavaScript messages on the main thread.
+class IOThread {
+ public:
+  // Counters for work posted with Post(). Delay is the time from Post() until
+  // the work starts; busy time is how long it runs. Completions are the
+  // Pepper callbacks timed by CompletionTimer, which the loop runs directly.
+  struct Stats {
+    uint64_t tasks = 0;
+    uint64_t total_delay_us = 0;
+    uint32_t max_delay_us = 0;
+    uint64_t busy_us = 0;
+    uint64_t completions = 0;
+    uint64_t completion_busy_us = 0;
+  };
+
+  // Times the Pepper completion callback it is created in, for stats(). Does
+  // nothing if |thread| is nullptr.
+  class CompletionTimer {
+   public:
+    explicit CompletionTimer(IOThread* thread);
+    ~CompletionTimer();
+
+   private:
+    IOThread* const thread_;
+    struct timespec start_;
+
+    // Disable copy and assignment.
+    CompletionTimer(const CompletionTimer&) = delete;
+    CompletionTimer& operator=(const CompletionTimer&) = delete;
+  };
+
+  explicit IOThread(const pp::InstanceHandle& instance_handle);
+  ~IOThread();
+
+  // Starts the thread, and waits for its message loop to attach. Returns
+  // false on failure, in which case the caller should use the main thread.
+  bool Start();
+
+  // Runs |callback| on |thread|, or on the main thread if |thread| is nullptr
+  // or not running. Can be called from any thread.
+  static void Post(IOThread* thread, const pp::CompletionCallback& callback);
+
+  Stats stats() const;
+
+ private:
+  static void* Run(void* data);
+  void RunTask(int32_t result, const pp::CompletionCallback& callback,
+               const struct timespec& posted);
+
+  pp::MessageLoop loop_;
+  pthread_t thread_;
+  bool running_ = false;
+  // The result of attaching |loop_|, for Start() to wait on.
+  std::promise<int32_t> attached_;
+  Stats stats_;  // Guard with stats_lock_.
+  mutable pthread::Mutex stats_lock_;
+  pp::CompletionCallbackFactory<IOThread, pp::ThreadSafeThreadTraits> factory_;
+
+  // Disable copy and assignment.
+  IOThread(const IOThread&) = delete;
+  IOThread& operator=(const IOThread&) = delete;
+};
+
+}  // namespace PepperPOSIX
+
+#endif  // MOSH_NACL_PEPPER_POSIX_IO_THREAD_H_
@@ -19,19 +19,77 @@
 
 #include <errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/uio.h>
+#include <utility>
 
 #include "ppapi/c/pp_errors.h"
 #include "ppapi/cpp/completion_callback.h"
-#include "ppapi/cpp/module.h"
 #include "ppapi/cpp/var.h"
 
 namespace PepperPOSIX {
 
-NativeTCP::NativeTCP(const pp::InstanceHandle& instance_handle)
-    : socket_(new pp::TCPSocket(instance_handle)), factory_(this) {}
+namespace {
+
+// Maps a Pepper error code from a socket operation to an errno value.
+int ErrnoFromPPError(int32_t result) {
+  switch (result) {
+    case PP_ERROR_NOACCESS:
+      return EACCES;
+    case PP_ERROR_ADDRESS_UNREACHABLE:
+      return EHOSTUNREACH;
+    case PP_ERROR_CONNECTION_REFUSED:
+      return ECONNREFUSED;
+    case PP_ERROR_CONNECTION_TIMEDOUT:
+      return ETIMEDOUT;
+    case PP_ERROR_CONNECTION_RESET:
+      return ECONNRESET;
+    case PP_ERROR_CONNECTION_ABORTED:
+      return ECONNABORTED;
+    case PP_ERROR_CONNECTION_CLOSED:
+      return EPIPE;
+    default:
+      return EIO;
+  }
+}
+
+// Maps a socket option to its Pepper equivalent. Returns false if there isn't
+// one.
+bool PPOptionFromSockOpt(int level, int optname, PP_TCPSocket_Option* option) {
+  if (level == IPPROTO_TCP && optname == TCP_NODELAY) {
+    *option = PP_TCPSOCKET_OPTION_NO_DELAY;
+    return true;
+  }
+  if (level == SOL_SOCKET && optname == SO_SNDBUF) {
+    *option = PP_TCPSOCKET_OPTION_SEND_BUFFER_SIZE;
+    return true;
+  }
+  if (level == SOL_SOCKET && optname == SO_RCVBUF) {
+    *option = PP_TCPSOCKET_OPTION_RECV_BUFFER_SIZE;
+    return true;
+  }
+  return false;
+}
+
+// The options PPOptionFromSockOpt() maps, as {level, optname}.
+const int kAppliedOptions[][2] = {
+    {IPPROTO_TCP, TCP_NODELAY},
+    {SOL_SOCKET, SO_SNDBUF},
+    {SOL_SOCKET, SO_RCVBUF},
+};
+
+}  // anonymous namespace
+
+NativeTCP::NativeTCP(const pp::InstanceHandle& instance_handle,
+                     IOThread* io_thread)
+    : socket_(new pp::TCPSocket(instance_handle)),
+      io_thread_(io_thread),
+      receive_callbacks_(0),
+      receive_bytes_(0),
+      receive_copied_bytes_(0),
+      factory_(this) {}
 
 NativeTCP::~NativeTCP() {}
 
@@ -55,18 +113,36 @@ int NativeTCP::Connect(const pp::NetAddress& address) {
   if (IsBlocking() == true) {
     Log("NativeTCP::Connect(): Not in non-blocking mode, not implemented!");
   }
-  // API calls need to be done on the main thread.
-  pp::Module::Get()->core()->CallOnMainThread(
-      0, factory_.NewCallback(&NativeTCP::ConnectOnMainThread));
+  // Asynchronous API calls need a thread with a message loop; the completions
+  // will run there too.
+  IOThread::Post(io_thread_,
+                 factory_.NewCallback(&NativeTCP::ConnectOnIOThread));
   return EINPROGRESS;
 }
 
-// This callback should only be called on the main thread.
-void NativeTCP::ConnectOnMainThread(__attribute__((unused)) int32_t unused) {
-  int32_t result =
-      socket_->Connect(address_, factory_.NewCallback(&NativeTCP::Connected));
+int NativeTCP::GetPeerName(pp::NetAddress* address) {
+  pthread::MutexLock m(options_lock_);
+  if (!connected_) {
+    return ENOTCONN;
+  }
+  *address = address_;
+  return 0;
+}
+
+// This callback should only be called on the I/O thread (or the main thread,
+// if there isn't one).
+void NativeTCP::ConnectOnIOThread(__attribute__((unused)) int32_t unused) {
+  int32_t result;
+  {
+    pthread::MutexLock m(send_lock_);
+    if (socket_ == nullptr) {
+      return;
+    }
+    result =
+        socket_->Connect(address_, factory_.NewCallback(&NativeTCP::Connected));
+  }
   if (result != PP_OK_COMPLETIONPENDING) {
-    Log("NativeTCP::ConnectOnMainThread(): "
+    Log("NativeTCP::ConnectOnIOThread(): "
         "socket_->Connect() returned %d",
         result);
     // TODO(rpwoodbu): Perhaps crash here?
@@ -75,71 +151,256 @@ void NativeTCP::ConnectOnMainThread(__attribute__((unused)) int32_t unused) {
 }
 
 void NativeTCP::Connected(int32_t result) {
+  IOThread::CompletionTimer timer(io_thread_);
   if (result == PP_OK) {
+    {
+      pthread::MutexLock m(options_lock_);
+      connected_ = true;
+      for (const auto& opt : kAppliedOptions) {
+        int value;
+        PP_TCPSocket_Option option;
+        if (File::GetSockOpt(opt[0], opt[1], &value) == 0 &&
+            PPOptionFromSockOpt(opt[0], opt[1], &option)) {
+          ApplyOption(0, option, value);
+        }
+      }
+    }
     target_->UpdateWrite(true);
     StartReceive();
     return;
   }
 
-  Log("NativeTCP::Connected(): Connection failed; result: %d", result);
-  switch (result) {
-    case PP_ERROR_NOACCESS:
-      connection_errno_ = EACCES;
-      break;
-    case PP_ERROR_ADDRESS_UNREACHABLE:
-      connection_errno_ = EHOSTUNREACH;
-      break;
-    case PP_ERROR_CONNECTION_REFUSED:
-      connection_errno_ = ECONNREFUSED;
-      break;
-    case PP_ERROR_CONNECTION_TIMEDOUT:
-      connection_errno_ = ETIMEDOUT;
-      break;
-    default:
-      connection_errno_ = EIO;
-      break;
-  }
-
-  target_->UpdateWrite(true);
-  target_->UpdateRead(true);
+  LogError("NativeTCP::Connected(): Connection failed; result: %d", result);
+  // The error makes the socket both readable and writable, so that a
+  // nonblocking connect() sees it.
+  AddError(ErrnoFromPPError(result));
 }
 
 ssize_t NativeTCP::Send(const void* buf, size_t count, int flags) {
   if (flags != 0) {
     Log("NativeTCP::Send(): Unsupported flag: 0x%x", flags);
   }
-  int32_t result =
-      socket_->Write((const char*)buf, count, pp::CompletionCallback());
+  if (connection_errno_ != 0) {
+    errno = connection_errno_;
+    return -1;
+  }
+  if (count == 0) {
+    return 0;
+  }
+  {
+    // Until Connected(), leave write readiness alone; a nonblocking connect()
+    // takes it to mean the connection is done.
+    pthread::MutexLock m(options_lock_);
+    if (!connected_) {
+      errno = EWOULDBLOCK;
+      return -1;
+    }
+  }
+
+  pthread::MutexLock m(send_lock_);
+  if (send_queued_ >= TCP_SEND_QUEUE_LIMIT) {
+    errno = EWOULDBLOCK;
+    return -1;
+  }
+
+  // The whole write is accepted, even if it overfills the queue a little.
+  const char* cbuf = static_cast<const char*>(buf);
+  const bool back_in_flight = writing_ && send_queue_.size() == 1;
+  if (send_queue_.size() > 0 && !back_in_flight &&
+      send_queue_.back().size() + count <= TCP_SEND_CHUNK_SIZE) {
+    send_queue_.back().insert(send_queue_.back().end(), cbuf, cbuf + count);
+  } else {
+    send_queue_.emplace_back(cbuf, cbuf + count);
+  }
+  send_queued_ += count;
+  target_->UpdateWrite(send_queued_ < TCP_SEND_QUEUE_LIMIT);
+
+  if (!writing_) {
+    writing_ = true;
+    IOThread::Post(io_thread_, factory_.NewCallback(&NativeTCP::StartWrite));
+  }
+  return count;
+}
+
+// StartWrite writes the front chunk of |send_queue_|, and returns without
+// blocking. Called on the I/O thread.
+void NativeTCP::StartWrite(__attribute__((unused)) int32_t unused) {
+  int32_t result;
+  {
+    pthread::MutexLock m(send_lock_);
+    if (socket_ == nullptr) {
+      writing_ = false;
+      return;
+    }
+    const auto& chunk = send_queue_.front();
+    result = socket_->Write(chunk.data() + send_offset_,
+                            chunk.size() - send_offset_,
+                            factory_.NewCallback(&NativeTCP::Wrote));
+  }
+  if (result != PP_OK_COMPLETIONPENDING) {
+    // The callback will not be called.
+    Wrote(result);
+  }
+}
+
+// Wrote is the callback result of StartWrite(). It starts the next write, if
+// there is more to send.
+void NativeTCP::Wrote(int32_t result) {
+  IOThread::CompletionTimer timer(io_thread_);
+  if (result == PP_ERROR_ABORTED) {
+    // The socket was closed locally.
+    return;
+  }
   if (result < 0) {
-    Log("NativeTCP::Send(): Got negative result: %d", result);
+    LogError("NativeTCP::Wrote(%d): Negative result.", result);
+    {
+      pthread::MutexLock m(send_lock_);
+      send_queue_.clear();
+      send_offset_ = 0;
+      send_queued_ = 0;
+      writing_ = false;
+    }
+    AddError(ErrnoFromPPError(result));
+    return;
+  }
+
+  {
+    pthread::MutexLock m(send_lock_);
+    send_offset_ += result;
+    send_queued_ -= result;
+    if (send_offset_ == send_queue_.front().size()) {
+      send_queue_.pop_front();
+      send_offset_ = 0;
+    }
+    target_->UpdateWrite(send_queued_ < TCP_SEND_QUEUE_LIMIT);
+    if (send_queued_ == 0) {
+      writing_ = false;
+      return;
+    }
+  }
+  StartWrite(0);
+}
+
+int NativeTCP::SetSockOpt(int level, int optname, int value) {
+  pthread::MutexLock m(options_lock_);
+  File::SetSockOpt(level, optname, value);
+  PP_TCPSocket_Option option;
+  if (connected_ && PPOptionFromSockOpt(level, optname, &option)) {
+    IOThread::Post(io_thread_, factory_.NewCallback(&NativeTCP::ApplyOption,
+                                                    option, value));
+  }
+  return 0;
+}
+
+// ApplyOption sets |option| on the socket. Called on the I/O thread.
+void NativeTCP::ApplyOption(__attribute__((unused)) int32_t unused,
+                            PP_TCPSocket_Option option, int value) {
+  const pp::Var var = option == PP_TCPSOCKET_OPTION_NO_DELAY
+                          ? pp::Var(value != 0)
+                          : pp::Var(static_cast<int32_t>(value));
+  int32_t result;
+  {
+    pthread::MutexLock m(send_lock_);
+    if (socket_ == nullptr) {
+      return;
+    }
+    result = socket_->SetOption(option, var,
+                                factory_.NewCallback(&NativeTCP::OptionSet));
+  }
+  if (result != PP_OK_COMPLETIONPENDING) {
+    // The callback will not be called.
+    OptionSet(result);
+  }
+}
+
+// OptionSet is the callback result of ApplyOption().
+void NativeTCP::OptionSet(int32_t result) {
+  if (result != PP_OK && result != PP_ERROR_ABORTED) {
+    Log("NativeTCP::OptionSet(): SetOption() failed with %d", result);
   }
-  return result;
 }
 
 // StartReceive prepares to receive more data, and returns without blocking.
 void NativeTCP::StartReceive() {
-  int32_t result = socket_->Read(receive_buffer_, sizeof(receive_buffer_),
-                                 factory_.NewCallback(&NativeTCP::Received));
+  receive_buffer_.resize(receive_size_);
+  int32_t result;
+  {
+    pthread::MutexLock m(send_lock_);
+    if (socket_ == nullptr) {
+      // Closed while the last read completed.
+      return;
+    }
+    result = socket_->Read(receive_buffer_.data(), receive_buffer_.size(),
+                           factory_.NewCallback(&NativeTCP::Received));
+  }
   if (result != PP_OK_COMPLETIONPENDING) {
-    Log("NativeTCP::StartReceive(): Read unexpectedly returned %d", result);
+    LogError("NativeTCP::StartReceive(): Read unexpectedly returned %d",
+             result);
     // TODO(rpwoodbu): Perhaps crash here?
   }
 }
 
 // Received is the callback result of StartReceive().
 void NativeTCP::Received(int32_t result) {
+  IOThread::CompletionTimer timer(io_thread_);
+  if (result == PP_ERROR_ABORTED) {
+    // The socket was closed locally; nobody is listening anymore.
+    return;
+  }
   if (result < 0) {
-    Log("NativeTCP::Received(%d, ...): Negative result; bailing.", result);
+    LogError("NativeTCP::Received(%d, ...): Negative result.", result);
+    AddError(ErrnoFromPPError(result));
+    return;
+  }
+  if (result == 0) {
+    // The peer closed the connection.
+    AddEOF();
     return;
   }
-  AddData(receive_buffer_, result);
+  ++receive_callbacks_;
+  receive_bytes_ += result;
+
+  // Grow when reads fill the buffer, and shrink when they use little of it.
+  if (result == receive_size_ && receive_size_ < TCP_RECEIVE_BUFFER_MAX) {
+    receive_size_ *= 2;
+  } else if (result < receive_size_ / 8 &&
+             receive_size_ > TCP_RECEIVE_BUFFER_MIN) {
+    receive_size_ /= 2;
+  }
+
+  // Hand a mostly full buffer over rather than copying it, and let
+  // StartReceive() allocate a new one. Otherwise copy out just the data and
+  // reuse the buffer, so that a small read doesn't hold on to a big buffer.
+  if (result >= receive_buffer_.size() / 4 * 3) {
+    receive_buffer_.resize(result);
+    AddData(std::move(receive_buffer_));
+    receive_buffer_ = std::vector<char>();
+  } else {
+    AddData(receive_buffer_.data(), result);
+    receive_copied_bytes_ += result;
+  }
   // Await another packet.
   StartReceive();
 }
 
 // Close the socket.
 int NativeTCP::Close() {
+  const uint64_t callbacks = receive_callbacks_;
+  if (callbacks > 0) {
+    // Before buffers were handed over, every byte received was copied.
+    const uint64_t bytes = receive_bytes_;
+    const uint64_t copied = receive_copied_bytes_;
+    Log("NativeTCP::Close(): Received %llu bytes in %llu callbacks, "
+        "%llu bytes per callback; copied %llu bytes, down from %llu",
+        static_cast<unsigned long long>(bytes),      // NOLINT(runtime/int)
+        static_cast<unsigned long long>(callbacks),  // NOLINT(runtime/int)
+        static_cast<unsigned long long>(bytes / callbacks),  // NOLINT
+        static_cast<unsigned long long>(copied),  // NOLINT(runtime/int)
+        static_cast<unsigned long long>(bytes));  // NOLINT(runtime/int)
+  }
+
   // Destroying socket_ is the same as closing it.
+  pthread::MutexLock m(send_lock_);
   socket_.reset();
   return 0;
 }
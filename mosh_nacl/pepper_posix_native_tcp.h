@@ -18,22 +18,46 @@
 #ifndef MOSH_NACL_PEPPER_POSIX_NATIVE_TCP_H_
 #define MOSH_NACL_PEPPER_POSIX_NATIVE_TCP_H_
 
+#include "mosh_nacl/pepper_posix_io_thread.h"
 #include "mosh_nacl/pepper_posix_tcp.h"
 
+#include <atomic>
+#include <deque>
 #include <memory>
+#include <vector>
+
+#include "mosh_nacl/pthread_locks.h"
 
 #include "ppapi/cpp/instance_handle.h"
 #include "ppapi/cpp/tcp_socket.h"
 #include "ppapi/utility/completion_callback_factory.h"
 
-const int TCP_RECEIVE_BUFFER_SIZE = 64 * 1024;  // 64 kB, a decent window size.
+// Receive buffers start small, for the SSH bootstrap's short messages, and
+// grow toward the observed read size.
+const size_t TCP_RECEIVE_BUFFER_MIN = 4 * 1024;
+const size_t TCP_RECEIVE_BUFFER_MAX = 256 * 1024;
+// Unsent data beyond this makes the socket unwritable.
+const size_t TCP_SEND_QUEUE_LIMIT = 256 * 1024;
+// Small writes are coalesced into chunks of up to this size.
+const size_t TCP_SEND_CHUNK_SIZE = 16 * 1024;
 
 namespace PepperPOSIX {
 
-// NativeTCP implements TCP using the native Pepper TCPSockets API.
+// NativeTCP implements TCP using the native Pepper TCPSockets API. Connecting,
+// receiving, and sending run on |io_thread|, or on the main thread if it is
+// nullptr.
+//
+// Send() queues data and returns at once; queued data is written by a chain of
+// completions, so that several writes can be in the pipeline. The socket is
+// writable while less than TCP_SEND_QUEUE_LIMIT bytes are queued. Data still
+// queued when the socket is closed is discarded.
+//
+// TCP_NODELAY, SO_SNDBUF, and SO_RCVBUF are applied to the Pepper socket once
+// it is connected; a failure to apply one is only logged, as setsockopt() has
+// returned by then. Other options are only recorded.
 class NativeTCP : public TCP {
  public:
-  explicit NativeTCP(const pp::InstanceHandle& instance_handle);
+  NativeTCP(const pp::InstanceHandle& instance_handle, IOThread* io_thread);
   ~NativeTCP() override;
 
   // Bind replaces bind().
@@ -42,23 +66,56 @@ class NativeTCP : public TCP {
   // Connect replaces connect().
   int Connect(const pp::NetAddress& address) override;
 
+  int GetPeerName(pp::NetAddress* address) override;
+
   // Send replaces send().
   ssize_t Send(const void* buf, size_t count, int flags) override;
 
   // Close replaces close().
   int Close() override;
 
+  int SetSockOpt(int level, int optname, int value) override;
+
  private:
-  void ConnectOnMainThread(int32_t unused);
+  void ConnectOnIOThread(int32_t unused);
   void Connected(int32_t result);
+  void ApplyOption(int32_t unused, PP_TCPSocket_Option option, int value);
+  void OptionSet(int32_t result);
   void StartReceive();
   void Received(int32_t result);
+  void StartWrite(int32_t unused);
+  void Wrote(int32_t result);
 
   std::unique_ptr<pp::TCPSocket> socket_;
-  char receive_buffer_[TCP_RECEIVE_BUFFER_SIZE];
-  pp::CompletionCallbackFactory<NativeTCP> factory_;
+  IOThread* const io_thread_;  // Not owned.
+  // The buffer being read into. It is handed over to the Stream when a read
+  // mostly fills it, and reused otherwise; only the I/O thread touches it.
+  std::vector<char> receive_buffer_;
+  size_t receive_size_ = TCP_RECEIVE_BUFFER_MIN;
+  std::atomic<uint64_t> receive_callbacks_;
+  std::atomic<uint64_t> receive_bytes_;
+  // Bytes copied out of |receive_buffer_| rather than handed over with it.
+  std::atomic<uint64_t> receive_copied_bytes_;
+  pp::CompletionCallbackFactory<NativeTCP, pp::ThreadSafeThreadTraits>
+      factory_;
   pp::NetAddress address_;
 
+  // Unsent data, in chunks. The front chunk is being written, from
+  // |send_offset_|, while |writing_|; it must not be modified then, as Pepper
+  // is reading from it. Guard all of these with send_lock_, which also guards
+  // |socket_| against Close(): hold it around every use of |socket_| on the
+  // I/O thread.
+  std::deque<std::vector<char>> send_queue_;
+  size_t send_offset_ = 0;
+  size_t send_queued_ = 0;  // Total unsent bytes.
+  bool writing_ = false;
+  pthread::Mutex send_lock_;
+
+  // Options set before the connection completes are applied by Connected().
+  // Guard |connected_| and the recorded options with options_lock_.
+  bool connected_ = false;
+  pthread::Mutex options_lock_;
+
   // Disable copy and assignment.
   NativeTCP(const NativeTCP&) = delete;
   NativeTCP& operator=(const NativeTCP&) = delete;
@@ -23,23 +23,22 @@
 #include <string.h>
 #include <sys/uio.h>
 #include <memory>
-#include <vector>
-
-#include "mosh_nacl/make_unique.h"
+#include <utility>
 
 #include "ppapi/c/pp_errors.h"
 #include "ppapi/cpp/completion_callback.h"
-#include "ppapi/cpp/module.h"
 #include "ppapi/cpp/var.h"
 
 namespace PepperPOSIX {
 
-using std::vector;
-using util::make_unique;
-
-NativeUDP::NativeUDP(const pp::InstanceHandle instance_handle)
+NativeUDP::NativeUDP(const pp::InstanceHandle instance_handle,
+                     IOThread* io_thread)
     : socket_(new pp::UDPSocket(instance_handle)),
       instance_handle_(instance_handle),
+      io_thread_(io_thread),
+      receive_callbacks_(0),
+      receive_bytes_(0),
+      receive_copied_bytes_(0),
       factory_(this) {}
 
 NativeUDP::~NativeUDP() {}
@@ -52,17 +51,30 @@ int NativeUDP::Bind(const pp::NetAddress& address) {
     return false;
   }
 
-  int32_t result = socket_->Bind(address, pp::CompletionCallback());
+  int32_t result;
+  {
+    pthread::MutexLock m(socket_lock_);
+    if (socket_ == nullptr) {
+      return EBADF;
+    }
+    result = socket_->Bind(address, pp::CompletionCallback());
+  }
   if (result == PP_OK) {
     bound_ = true;
-    pp::Module::Get()->core()->CallOnMainThread(
-        0, factory_.NewCallback(&NativeUDP::StartReceive));
+    for (int optname : {SO_SNDBUF, SO_RCVBUF}) {
+      int value;
+      if (File::GetSockOpt(SOL_SOCKET, optname, &value) == 0) {
+        ApplyOption(optname, value);
+      }
+    }
+    // Receive completions run on the thread that started the receive.
+    IOThread::Post(io_thread_, factory_.NewCallback(&NativeUDP::StartReceive));
   }
   // TODO(rpwoodbu): Flesh out error mapping.
   return result;
 }
 
-ssize_t NativeUDP::Send(const vector<char>& buf,
+ssize_t NativeUDP::Send(const void* buf, size_t count,
                         __attribute__((unused)) int flags,
                         const pp::NetAddress& address) {
   if (!bound_) {
@@ -88,15 +100,26 @@ ssize_t NativeUDP::Send(const vector<char>& buf,
     }
   }
 
-  int32_t result = socket_->SendTo(buf.data(), buf.size(), address,
-                                   pp::CompletionCallback());
+  // Pepper copies the data before SendTo() returns (it is a blocking call), so
+  // the caller's buffer can be handed over directly.
+  int32_t result;
+  {
+    pthread::MutexLock m(socket_lock_);
+    if (socket_ == nullptr) {
+      errno = EBADF;
+      return -1;
+    }
+    result = socket_->SendTo(static_cast<const char*>(buf), count, address,
+                             pp::CompletionCallback());
+  }
   if (result < 0) {
     switch (result) {
       case PP_ERROR_ADDRESS_UNREACHABLE:
         errno = EHOSTUNREACH;
         break;
       default:
-        // Set errno to something, even if it isn't precise.
+        // Set errno to something, even if it isn't precise. Mosh keeps
+        // sending while the network is down, so this must be rate limited.
         Log("NativeUDP::Send(): socket_->SendTo() failed with %d", result);
         errno = EIO;
         break;
@@ -108,9 +131,18 @@ ssize_t NativeUDP::Send(const vector<char>& buf,
 // StartReceive prepares to receive another packet, and returns without
 // blocking.
 void NativeUDP::StartReceive(__attribute__((unused)) int32_t unused) {
-  int32_t result =
-      socket_->RecvFrom(receive_buffer_, sizeof(receive_buffer_),
-                        factory_.NewCallbackWithOutput(&NativeUDP::Received));
+  receive_buffer_.resize(receive_size_);
+  int32_t result;
+  {
+    pthread::MutexLock m(socket_lock_);
+    if (socket_ == nullptr) {
+      // Closed while the last packet was received.
+      return;
+    }
+    result =
+        socket_->RecvFrom(receive_buffer_.data(), receive_buffer_.size(),
+                          factory_.NewCallbackWithOutput(&NativeUDP::Received));
+  }
   if (result != PP_OK_COMPLETIONPENDING) {
     Log("NativeUDP::StartReceive(): RecvFrom returned %d", result);
     // TODO(rpwoodbu): Perhaps crash here?
@@ -119,18 +151,89 @@ void NativeUDP::StartReceive(__attribute__((unused)) int32_t unused) {
 
 // Received is the callback result of StartReceive().
 void NativeUDP::Received(int32_t result, const pp::NetAddress& address) {
+  IOThread::CompletionTimer timer(io_thread_);
   if (result < 0) {
     Log("NativeUDP::Received(%d, ...): Negative result; bailing.", result);
     return;
   }
-  AddPacket(make_unique<MsgHdr>(address, result, receive_buffer_));
+  ++receive_callbacks_;
+  receive_bytes_ += result;
+
+  // A full buffer may mean the datagram was truncated; allow for bigger ones.
+  if (result == receive_size_ && receive_size_ < UDP_RECEIVE_BUFFER_MAX) {
+    receive_size_ *= 2;
+    if (receive_size_ > UDP_RECEIVE_BUFFER_MAX) {
+      receive_size_ = UDP_RECEIVE_BUFFER_MAX;
+    }
+  }
+
+  // Hand a mostly full buffer over rather than copying it, and let
+  // StartReceive() allocate a new one. Otherwise copy out just the data and
+  // reuse the buffer, so that a small read doesn't hold on to a big buffer.
+  if (result >= receive_buffer_.size() / 4 * 3) {
+    receive_buffer_.resize(result);
+    AddPacket(address, std::move(receive_buffer_));
+    receive_buffer_ = std::vector<char>();
+  } else {
+    AddPacket(address, receive_buffer_.data(), result);
+    receive_copied_bytes_ += result;
+  }
   // Await another packet.
   StartReceive(0);
 }
 
+int NativeUDP::SetSockOpt(int level, int optname, int value) {
+  if (bound_ && level == SOL_SOCKET &&
+      (optname == SO_SNDBUF || optname == SO_RCVBUF)) {
+    if (ApplyOption(optname, value) != 0) {
+      return -1;
+    }
+  }
+  return File::SetSockOpt(level, optname, value);
+}
+
+// ApplyOption sets a buffer size on the bound socket. Like Bind(), it blocks.
+int NativeUDP::ApplyOption(int optname, int value) {
+  const PP_UDPSocket_Option option = optname == SO_SNDBUF
+                                         ? PP_UDPSOCKET_OPTION_SEND_BUFFER_SIZE
+                                         : PP_UDPSOCKET_OPTION_RECV_BUFFER_SIZE;
+  int32_t result;
+  {
+    pthread::MutexLock m(socket_lock_);
+    if (socket_ == nullptr) {
+      errno = EBADF;
+      return -1;
+    }
+    result = socket_->SetOption(option, pp::Var(static_cast<int32_t>(value)),
+                                pp::CompletionCallback());
+  }
+  if (result != PP_OK) {
+    Log("NativeUDP::ApplyOption(): SetOption(%d, %d) failed with %d", option,
+        value, result);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
 // Close the socket.
 int NativeUDP::Close() {
+  const uint64_t callbacks = receive_callbacks_;
+  if (callbacks > 0) {
+    // Before buffers were handed over, every byte received was copied.
+    const uint64_t bytes = receive_bytes_;
+    const uint64_t copied = receive_copied_bytes_;
+    Log("NativeUDP::Close(): Received %llu bytes in %llu callbacks, "
+        "%llu bytes per callback; copied %llu bytes, down from %llu",
+        static_cast<unsigned long long>(bytes),      // NOLINT(runtime/int)
+        static_cast<unsigned long long>(callbacks),  // NOLINT(runtime/int)
+        static_cast<unsigned long long>(bytes / callbacks),  // NOLINT
+        static_cast<unsigned long long>(copied),  // NOLINT(runtime/int)
+        static_cast<unsigned long long>(bytes));  // NOLINT(runtime/int)
+  }
+
   // Destroying socket_ is the same as closing it.
+  pthread::MutexLock m(socket_lock_);
   socket_.reset();
   return 0;
 }
@@ -18,44 +18,71 @@
 #ifndef MOSH_NACL_PEPPER_POSIX_NATIVE_UDP_H_
 #define MOSH_NACL_PEPPER_POSIX_NATIVE_UDP_H_
 
+#include "mosh_nacl/pepper_posix_io_thread.h"
 #include "mosh_nacl/pepper_posix_udp.h"
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
+#include "mosh_nacl/pthread_locks.h"
+
 #include "ppapi/cpp/instance_handle.h"
 #include "ppapi/cpp/udp_socket.h"
 #include "ppapi/utility/completion_callback_factory.h"
 
-const int UDP_RECEIVE_BUFFER_SIZE = 1500;  // Typical MTU.
+// Receive buffers are sized to the path MTU; Pepper does not report it, so
+// this starts at the typical MTU, and grows if a datagram fills the buffer.
+const size_t UDP_RECEIVE_BUFFER_MIN = 1500;
+const size_t UDP_RECEIVE_BUFFER_MAX = 64 * 1024;
 
 namespace PepperPOSIX {
 
-// NativeUDP implements UDP using the native Pepper UDPSockets API.
+// NativeUDP implements UDP using the native Pepper UDPSockets API. Receiving
+// runs on |io_thread|, or on the main thread if it is nullptr.
+//
+// SO_SNDBUF and SO_RCVBUF can only be applied to a bound Pepper socket, so
+// those set earlier are applied by Bind(). Other options are only recorded.
 class NativeUDP : public UDP {
  public:
-  explicit NativeUDP(const pp::InstanceHandle instance_handle);
+  NativeUDP(const pp::InstanceHandle instance_handle, IOThread* io_thread);
   ~NativeUDP() override;
 
   // Bind replaces bind().
   int Bind(const pp::NetAddress& address) override;
 
   // Send replaces sendto. Usage is similar, but tweaked for C++.
-  ssize_t Send(const std::vector<char>& buf, int flags,
+  ssize_t Send(const void* buf, size_t count, int flags,
                const pp::NetAddress& address) override;
 
   // Close replaces close().
   int Close() override;
 
+  int SetSockOpt(int level, int optname, int value) override;
+
  private:
+  int ApplyOption(int optname, int value);
   void StartReceive(int32_t unused);
   void Received(int32_t result, const pp::NetAddress& address);
 
+  // Guard |socket_| with socket_lock_ around every use, as Close() can reset
+  // it on another thread while receiving runs on the I/O thread.
   std::unique_ptr<pp::UDPSocket> socket_;
+  pthread::Mutex socket_lock_;
   bool bound_ = false;
   const pp::InstanceHandle instance_handle_;
-  char receive_buffer_[UDP_RECEIVE_BUFFER_SIZE];
-  pp::CompletionCallbackFactory<NativeUDP> factory_;
+  IOThread* const io_thread_;  // Not owned.
+  // The buffer being received into. It is handed over to UDP with a packet
+  // that mostly fills it, and reused otherwise; only the thread receiving
+  // touches it.
+  std::vector<char> receive_buffer_;
+  size_t receive_size_ = UDP_RECEIVE_BUFFER_MIN;
+  std::atomic<uint64_t> receive_callbacks_;
+  std::atomic<uint64_t> receive_bytes_;
+  // Bytes copied out of |receive_buffer_| rather than handed over with it.
+  std::atomic<uint64_t> receive_copied_bytes_;
+  pp::CompletionCallbackFactory<NativeUDP, pp::ThreadSafeThreadTraits>
+      factory_;
 
   // Disable copy and assignment.
   NativeUDP(const NativeUDP&) = delete;
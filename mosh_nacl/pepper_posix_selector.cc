@@ -19,7 +19,8 @@
 
 #include <assert.h>
 #include <errno.h>
-#include <unistd.h>
+#include <sched.h>
+#include <time.h>
 #include <algorithm>
 #include <memory>
 
@@ -31,7 +32,11 @@ using std::unique_ptr;
 using std::vector;
 using util::make_unique;
 
-Selector::Selector() {}
+Selector::Selector()
+    : sequence_(0),
+      adaptive_spin_(false),
+      mean_interval_us_(0),
+      last_notify_({0, 0}) {}
 
 Selector::~Selector() {
   // It is a logical error to delete Selector before all Targets have been
@@ -41,11 +46,13 @@ Selector::~Selector() {
 
 unique_ptr<Target> Selector::NewTarget(int id) {
   auto t = make_unique<Target>(*this, id);
+  pthread::MutexLock m(notify_mutex_);
   targets_.push_back(t.get());
   return t;
 }
 
 void Selector::Deregister(const Target& target) {
+  pthread::MutexLock m(notify_mutex_);
   for (auto iter = targets_.begin(); iter != targets_.end(); ++iter) {
     if (**iter == target) {
       targets_.erase(iter);
@@ -56,83 +63,208 @@ void Selector::Deregister(const Target& target) {
   assert(false);
 }
 
+namespace {
+
+const long kNanosecondsPerSecond = 1000000000L;  // NOLINT(runtime/int)
+
+// Longest single wait on |notify_cv_|. The condition variable measures time
+// with CLOCK_REALTIME, so each wait is kept short enough that a wall clock
+// jump cannot stretch a timeout by much; the overall deadline is kept on
+// CLOCK_MONOTONIC.
+const time_t kMaxWaitSeconds = 1;
+
+// Brings tv_nsec into [0, 1e9).
+void Normalize(struct timespec* ts) {
+  ts->tv_sec += ts->tv_nsec / kNanosecondsPerSecond;
+  ts->tv_nsec %= kNanosecondsPerSecond;
+  if (ts->tv_nsec < 0) {
+    ts->tv_nsec += kNanosecondsPerSecond;
+    --ts->tv_sec;
+  }
+}
+
+}  // anonymous namespace
+
+struct timespec TimespecAdd(struct timespec a, const struct timespec& b) {
+  a.tv_sec += b.tv_sec;
+  a.tv_nsec += b.tv_nsec;
+  Normalize(&a);
+  return a;
+}
+
+struct timespec TimespecSubtract(struct timespec a, const struct timespec& b) {
+  a.tv_sec -= b.tv_sec;
+  a.tv_nsec -= b.tv_nsec;
+  Normalize(&a);
+  return a;
+}
+
+namespace {
+
+bool IsPositive(const struct timespec& ts) {
+  return ts.tv_sec > 0 || (ts.tv_sec == 0 && ts.tv_nsec > 0);
+}
+
+// Inter-arrival times above this are not worth spinning for.
+const uint32_t kSpinThresholdMicroseconds = 1000;
+// Longest time Spin() will poll before falling back to blocking.
+const uint32_t kMaxSpinMicroseconds = 200;
+// Weight of each new sample in |mean_interval_us_| is 1/kIntervalWeight.
+const int64_t kIntervalWeight = 8;
+
+bool IsBefore(const struct timespec& a, const struct timespec& b) {
+  return IsPositive(TimespecSubtract(b, a));
+}
+
+}  // anonymous namespace
+
 void Selector::Notify() {
-  pthread::MutexLock m(notify_mutex_);
-  notify_cv_.Signal();
+  ++sequence_;
+  if (adaptive_spin_) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (last_notify_.tv_sec != 0 || last_notify_.tv_nsec != 0) {
+      const struct timespec elapsed = TimespecSubtract(now, last_notify_);
+      int64_t sample = kSpinThresholdMicroseconds * 2;
+      if (elapsed.tv_sec == 0) {
+        sample = std::min<int64_t>(sample, elapsed.tv_nsec / 1000);
+      }
+      const int64_t mean = mean_interval_us_;
+      mean_interval_us_ = mean == 0 ? sample
+                                    : mean + (sample - mean) / kIntervalWeight;
+    }
+    last_notify_ = now;
+  }
+  notify_cv_.Broadcast();
+}
+
+vector<Target*> Selector::Spin(const vector<Target*>& read_targets,
+                               const vector<Target*>& write_targets,
+                               const struct timespec* deadline) const {
+  vector<Target*> result;
+  const uint32_t mean = mean_interval_us_;
+  if (mean == 0 || mean > kSpinThresholdMicroseconds) {
+    // Unknown or too slow; spinning would most likely just burn CPU.
+    return result;
+  }
+
+  struct timespec limit;
+  clock_gettime(CLOCK_MONOTONIC, &limit);
+  const struct timespec budget = {
+      0, std::min(mean * 2, kMaxSpinMicroseconds) * 1000L};
+  limit = TimespecAdd(limit, budget);
+  if (deadline != nullptr && IsBefore(*deadline, limit)) {
+    limit = *deadline;
+  }
+
+  // Only rescan the targets when a Target has become ready since last time.
+  uint32_t seen = sequence_;
+  result = HasData(read_targets, write_targets);
+  for (;;) {
+    if (result.size() > 0) {
+      return result;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!IsBefore(now, limit)) {
+      return result;
+    }
+    sched_yield();
+    const uint32_t sequence = sequence_;
+    if (sequence != seen) {
+      seen = sequence;
+      result = HasData(read_targets, write_targets);
+    }
+  }
 }
 
 vector<Target*> Selector::Select(const vector<Target*>& read_targets,
                                  const vector<Target*>& write_targets,
                                  const struct timespec* timeout) {
-  struct timespec abstime;
+  struct timespec deadline;
   if (timeout != nullptr) {
     // Calculate absolute time for timeout. This should be done ASAP to reduce
     // the chances of this method not returning by the timeout specified. There
     // are no guarantees, of course.
-    clock_gettime(CLOCK_REALTIME, &abstime);
-    abstime.tv_sec += timeout->tv_sec;
-    abstime.tv_nsec += timeout->tv_nsec;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    deadline = TimespecAdd(now, *timeout);
   }
 
-  pthread::MutexLock m(notify_mutex_);
-
-  // Check if any data is available.
-  auto result = HasData(read_targets, write_targets);
-  if (result.size() > 0) {
-    // Data available now; return immediately.
-    return result;
+  if (adaptive_spin_) {
+    auto result = Spin(read_targets, write_targets,
+                       timeout == nullptr ? nullptr : &deadline);
+    if (result.size() > 0) {
+      return result;
+    }
   }
 
-  // Wait for a target to have data. Simple no-timeout case.
-  if (timeout == nullptr) {
-    notify_cv_.Wait(&notify_mutex_);
-    return HasData(read_targets, write_targets);
-  }
+  pthread::MutexLock m(notify_mutex_);
 
-  // Timeout case.
   for (;;) {
-    int wait_errno = 0;
-    if (!notify_cv_.TimedWait(&notify_mutex_, abstime)) {
-      wait_errno = notify_cv_.GetLastError();
-    }
-
-    result = HasData(read_targets, write_targets);
+    // Check if any data is available.
+    auto result = HasData(read_targets, write_targets);
     if (result.size() > 0) {
-      // We have data... no need to check anything.
+      // Data available now; return immediately.
       return result;
     }
 
-    if (wait_errno == ETIMEDOUT) {
-      struct timespec now;
-      clock_gettime(CLOCK_REALTIME, &now);
-      if (now.tv_sec < abstime.tv_sec) {
-        // Premature timeout. Retry.
-        // TODO(rpwoodbu): Remove this hack once the NaCl bug that causes this
-        // is fixed.
-        wait_errno = 0;
-        usleep(100000);
-      } else {
-        // We have a proper timeout. Return the empty result.
+    // Wait for a target to have data. Simple no-timeout case. Loop to handle
+    // spurious wakeups.
+    if (timeout == nullptr) {
+      if (!notify_cv_.Wait(&notify_mutex_)) {
+        // Something went wrong. Avoid looping forever.
         return result;
       }
-    } else {
-      // Something went wrong. Avoid looping forever, though, and just return
-      // the empty result.
+      continue;
+    }
+
+    // Timeout case. The remaining time is recomputed on every pass, so a
+    // premature ETIMEDOUT (a NaCl bug) simply waits again on |notify_cv_|,
+    // where a Notify() can still wake it.
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct timespec remaining = TimespecSubtract(deadline, now);
+    if (!IsPositive(remaining)) {
+      // We have a proper timeout. Return the empty result.
       return result;
     }
+    if (remaining.tv_sec >= kMaxWaitSeconds) {
+      remaining.tv_sec = kMaxWaitSeconds;
+      remaining.tv_nsec = 0;
+    }
+    struct timespec abstime;
+    clock_gettime(CLOCK_REALTIME, &abstime);
+    abstime = TimespecAdd(abstime, remaining);
+
+    if (!notify_cv_.TimedWait(&notify_mutex_, abstime) &&
+        notify_cv_.GetLastError() != ETIMEDOUT) {
+      // Something went wrong. Avoid looping forever, though, and just return
+      // whatever is available.
+      return HasData(read_targets, write_targets);
+    }
   }
 }
 
+vector<Target*> Selector::SelectAll(const struct timespec* timeout) {
+  vector<Target*> targets;
+  {
+    pthread::MutexLock m(notify_mutex_);
+    targets = targets_;
+  }
+  return Select(targets, targets, timeout);
+}
+
 vector<Target*> Selector::HasData(const vector<Target*>& read_targets,
                                   const vector<Target*>& write_targets) const {
   vector<Target*> result;
   for (auto* target : read_targets) {
-    if (target->has_read_data()) {
+    if (target->readable()) {
       result.push_back(target);
     }
   }
   for (auto* target : write_targets) {
-    if (target->has_write_data()) {
+    if (target->writable()) {
       result.push_back(target);
     }
   }
@@ -141,27 +273,23 @@ vector<Target*> Selector::HasData(const vector<Target*>& read_targets,
 
 Target::~Target() { selector_.Deregister(*this); }
 
-void Target::UpdateRead(bool has_data) {
-  if (has_data == has_read_data_) {
-    // No state change; do nothing.
-    return;
-  }
+void Target::UpdateRead(bool has_data) { Update(&has_read_data_, has_data); }
 
-  has_read_data_ = has_data;
-  if (has_data == true) {
-    // Only notify if we now have data.
-    selector_.Notify();
-  }
-}
+void Target::UpdateWrite(bool has_data) { Update(&has_write_data_, has_data); }
+
+void Target::UpdateError(bool has_error) { Update(&has_error_, has_error); }
+
+void Target::UpdateHangUp(bool hung_up) { Update(&hung_up_, hung_up); }
 
-void Target::UpdateWrite(bool has_data) {
-  if (has_data == has_write_data_) {
+void Target::Update(std::atomic<bool>* state, bool value) {
+  pthread::MutexLock m(selector_.notify_mutex_);
+  if (value == *state) {
     // No state change; do nothing.
     return;
   }
 
-  has_write_data_ = has_data;
-  if (has_data == true) {
+  *state = value;
+  if (value == true) {
     // Only notify if we now have data.
     selector_.Notify();
   }
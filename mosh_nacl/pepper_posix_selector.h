@@ -21,6 +21,9 @@
 #ifndef MOSH_NACL_PEPPER_POSIX_SELECTOR_H_
 #define MOSH_NACL_PEPPER_POSIX_SELECTOR_H_
 
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -30,6 +33,10 @@ namespace PepperPOSIX {
 
 class Target;  // This is declared fully below.
 
+// Timespec arithmetic, with the result's tv_nsec in [0, 1e9).
+struct timespec TimespecAdd(struct timespec a, const struct timespec& b);
+struct timespec TimespecSubtract(struct timespec a, const struct timespec& b);
+
 // Selector implements select()-style functionality for callback-style I/O.
 // In your I/O implementation, get and retain a Target instance by calling
 // NewTarget(). Call Target's UpdateRead() or UpdateWrite() methods whenever
@@ -51,7 +58,9 @@ class Selector {
   // Select returns a subset of targets for which data is available, or
   // waits until the timeout period has passed. It calls
   // pthread_cond_timedwait() if there are no targets with data available
-  // when the method is called.
+  // when the method is called. The timeout is measured with CLOCK_MONOTONIC,
+  // and a notification wakes Select() at any point during the wait. In
+  // adaptive spin mode (see SetAdaptiveSpin()), it may poll briefly first.
   //
   // Vectors of pointers were chosen for simplicity, even though ownership
   // looks ambiguous. The alternative would have been
@@ -62,26 +71,52 @@ class Selector {
                               const struct timespec* timeout);
 
   // SelectAll is similar to Select, but waits for all registered targets.
-  std::vector<Target*> SelectAll(const struct timespec* timeout) {
-    return Select(targets_, targets_, timeout);
-  }
+  std::vector<Target*> SelectAll(const struct timespec* timeout);
+
+  // Enables adaptive spinning. When on, Select() first polls for readiness
+  // with sched_yield() for a short time, if targets have recently been
+  // becoming ready often enough that a wakeup is likely to arrive sooner than
+  // a sleeping thread could be woken. Off by default.
+  void SetAdaptiveSpin(bool enabled) { adaptive_spin_ = enabled; }
+
+  // Count of notifications so far. It changes whenever any Target becomes
+  // ready, so callers can tell if anything happened without taking a lock.
+  uint32_t sequence() const { return sequence_; }
 
  private:
   // Notify is to be called only from class Target to indicate when
   // there is data available. Internally, Notify uses
-  // pthread_cond_signal() to indicate that there is data. It does not
-  // need to procure a lock, as it modifies no internal state.
+  // pthread_cond_broadcast() to indicate that there is data, as several
+  // threads may be selecting on different targets. Must be called with
+  // |notify_mutex_| held, immediately after the Target state change, so that
+  // Select() cannot miss it between checking HasData() and waiting.
   void Notify();
 
   // Deregister is to be called only from the class Target when it is
   // being destroyed and must deregister with Selector.
   void Deregister(const Target& target);
 
+  // Spin polls for data without taking |notify_mutex_| for a time derived
+  // from |mean_interval_us_|, and not past |deadline| if given. Returns
+  // the targets with data, or an empty vector if none became ready.
+  std::vector<Target*> Spin(const std::vector<Target*>& read_targets,
+                            const std::vector<Target*>& write_targets,
+                            const struct timespec* deadline) const;
+
   // HasData returns a vector of Targets that have data ready to be read.
   std::vector<Target*> HasData(const std::vector<Target*>& read_targets,
                                const std::vector<Target*>& write_targets) const;
 
-  std::vector<Target*> targets_;  // Does not own Targets!
+  std::vector<Target*> targets_;  // Does not own Targets! Guard with
+                                  // notify_mutex_.
+  // Incremented by every Notify(). Guard writes with notify_mutex_.
+  std::atomic<uint32_t> sequence_;
+  std::atomic<bool> adaptive_spin_;
+  // Moving average of the time between Notify() calls, in microseconds, or 0
+  // if unknown. Only tracked in adaptive spin mode. |last_notify_| is guarded
+  // by notify_mutex_.
+  std::atomic<uint32_t> mean_interval_us_;
+  struct timespec last_notify_;
   pthread::Mutex notify_mutex_;
   pthread::Conditional notify_cv_;
 
@@ -96,7 +131,13 @@ class Selector {
 class Target {
  public:
   // We default has_write_data_ to true, as many targets never block on writes.
-  Target(class Selector& s, int id) : selector_(s), id_(id) {}
+  Target(class Selector& s, int id)
+      : selector_(s),
+        id_(id),
+        has_read_data_(false),
+        has_write_data_(true),
+        has_error_(false),
+        hung_up_(false) {}
   ~Target();
 
   // UpdateRead updates Target whether there is pending data available in the
@@ -113,16 +154,38 @@ class Target {
   // superfluous notifications to Selector.
   void UpdateWrite(bool has_data);
 
+  // UpdateError updates Target whether the I/O target has failed, such as a
+  // connection that was refused or reset. UpdateHangUp updates Target whether
+  // the peer has closed its end, so that there will be no more data. Either
+  // makes the target ready for both reading and writing, so that the error or
+  // end of file can be discovered with a read or write.
+  void UpdateError(bool has_error);
+  void UpdateHangUp(bool hung_up);
+
+  // These may be read from any thread. State changes are made under the
+  // Selector's lock, which is what keeps Select() from losing wakeups.
   bool has_read_data() const { return has_read_data_; }
   bool has_write_data() const { return has_write_data_; }
+  bool has_error() const { return has_error_; }
+  bool hung_up() const { return hung_up_; }
+
+  // Whether a read or write would not block.
+  bool readable() const { return has_read_data_ || has_error_ || hung_up_; }
+  bool writable() const { return has_write_data_ || has_error_ || hung_up_; }
   int id() const { return id_; }
   bool operator==(const Target& rh) { return id() == rh.id(); }
 
  private:
   class Selector& selector_;
   int id_ = -1;
-  bool has_read_data_ = false;
-  bool has_write_data_ = true;
+  std::atomic<bool> has_read_data_;
+  std::atomic<bool> has_write_data_;
+  std::atomic<bool> has_error_;
+  std::atomic<bool> hung_up_;
+
+  // Sets |*state| to |value| under the Selector's lock, notifying the
+  // Selector if it became true.
+  void Update(std::atomic<bool>* state, bool value);
 
   // Disable copy and assignment.
   Target(const Target&) = delete;
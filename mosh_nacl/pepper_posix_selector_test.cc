@@ -0,0 +1,285 @@
+// pepper_posix_selector_test.cc - Tests for pepper_posix_selector.{h,cc}.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/pepper_posix_selector.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <algorithm>
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::unique_ptr;
+using std::vector;
+
+namespace PepperPOSIX {
+
+class SelectorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    target_ = selector_.NewTarget(0);
+    read_targets_.push_back(target_.get());
+  }
+
+  void TearDown() override { target_.reset(); }
+
+  Selector selector_;
+  unique_ptr<Target> target_;
+  vector<Target*> read_targets_;
+  const vector<Target*> no_targets_;
+};
+
+TEST_F(SelectorTest, ReturnsImmediatelyWithData) {
+  target_->UpdateRead(true);
+  const struct timespec timeout = {10, 0};
+  const auto start = steady_clock::now();
+  EXPECT_EQ(1, selector_.Select(read_targets_, no_targets_, &timeout).size());
+  EXPECT_LT(steady_clock::now() - start, milliseconds(100));
+}
+
+TEST_F(SelectorTest, TimesOut) {
+  const struct timespec timeout = {0, 50 * 1000 * 1000};
+  const auto start = steady_clock::now();
+  EXPECT_EQ(0, selector_.Select(read_targets_, no_targets_, &timeout).size());
+  const auto elapsed = steady_clock::now() - start;
+  EXPECT_GE(elapsed, milliseconds(50));
+  EXPECT_LT(elapsed, milliseconds(500));
+}
+
+// A timeout whose tv_nsec is nearly a whole second must still be honored.
+TEST_F(SelectorTest, TimesOutWithLargeNanoseconds) {
+  const struct timespec timeout = {0, 999999999};
+  const auto start = steady_clock::now();
+  EXPECT_EQ(0, selector_.Select(read_targets_, no_targets_, &timeout).size());
+  const auto elapsed = steady_clock::now() - start;
+  EXPECT_GE(elapsed, milliseconds(999));
+  EXPECT_LT(elapsed, milliseconds(1500));
+}
+
+// The worst-case delay between a notification and Select() returning must be
+// small, no matter when during the wait the notification lands.
+TEST_F(SelectorTest, WakeupLatencyIsBounded) {
+  const int kTrials = 50;
+  auto worst = steady_clock::duration::zero();
+  for (int i = 0; i < kTrials; ++i) {
+    target_->UpdateRead(false);
+    steady_clock::time_point notified;
+    std::thread notifier([this, i, &notified]() {
+      std::this_thread::sleep_for(std::chrono::microseconds(100 * i));
+      notified = steady_clock::now();
+      target_->UpdateRead(true);
+    });
+    const struct timespec timeout = {5, 0};
+    const auto result = selector_.Select(read_targets_, no_targets_, &timeout);
+    const auto woke = steady_clock::now();
+    notifier.join();
+    ASSERT_EQ(1, result.size());
+    if (woke - notified > worst) {
+      worst = woke - notified;
+    }
+  }
+  printf("Selector worst-case wakeup latency: %lld us\n",
+         static_cast<long long>(  // NOLINT(runtime/int)
+             duration_cast<std::chrono::microseconds>(worst).count()));
+  EXPECT_LT(worst, milliseconds(20));
+}
+
+TEST_F(SelectorTest, WakesWithoutTimeout) {
+  std::thread notifier([this]() {
+    std::this_thread::sleep_for(milliseconds(10));
+    target_->UpdateRead(true);
+  });
+  EXPECT_EQ(1, selector_.Select(read_targets_, no_targets_, nullptr).size());
+  notifier.join();
+}
+
+// Errors and hang-ups wake both readers and writers.
+TEST_F(SelectorTest, ErrorAndHangUpAreReadableAndWritable) {
+  target_->UpdateWrite(false);
+  const struct timespec timeout = {0, 0};
+  EXPECT_EQ(0, selector_.Select(read_targets_, read_targets_, &timeout).size());
+
+  target_->UpdateError(true);
+  EXPECT_TRUE(target_->has_error());
+  EXPECT_FALSE(target_->has_read_data());
+  EXPECT_EQ(2, selector_.Select(read_targets_, read_targets_, &timeout).size());
+  target_->UpdateError(false);
+
+  std::thread notifier([this]() {
+    std::this_thread::sleep_for(milliseconds(10));
+    target_->UpdateHangUp(true);
+  });
+  EXPECT_EQ(1, selector_.Select(no_targets_, read_targets_, nullptr).size());
+  notifier.join();
+  EXPECT_TRUE(target_->readable());
+  EXPECT_TRUE(target_->writable());
+}
+
+TEST_F(SelectorTest, SequenceAdvancesOnReadiness) {
+  const uint32_t before = selector_.sequence();
+  target_->UpdateRead(true);
+  EXPECT_NE(before, selector_.sequence());
+  const uint32_t after = selector_.sequence();
+  target_->UpdateRead(true);  // No state change.
+  target_->UpdateRead(false);
+  EXPECT_EQ(after, selector_.sequence());
+}
+
+// Several threads select on their own targets while producers race to make
+// them ready. A lost wakeup would leave a consumer asleep until its timeout,
+// so every readiness change must be seen within a small bound.
+TEST_F(SelectorTest, StressNoLostWakeups) {
+  const int kConsumers = 4;
+  const int kRounds = 500;
+  vector<unique_ptr<Target>> targets;
+  for (int i = 0; i < kConsumers; ++i) {
+    targets.push_back(selector_.NewTarget(i + 1));
+  }
+  std::atomic<long long> worst_us(0);  // NOLINT(runtime/int)
+  std::atomic<int> failures(0);
+
+  vector<std::thread> threads;
+  for (int i = 0; i < kConsumers; ++i) {
+    Target* target = targets[i].get();
+    // Time of the latest readiness change, in steady_clock ticks.
+    auto ready_at = std::make_shared<std::atomic<long long>>(0);  // NOLINT
+    auto consumed = std::make_shared<std::atomic<bool>>(true);
+    threads.emplace_back([target, ready_at, consumed, i]() {
+      for (int round = 0; round < kRounds; ++round) {
+        while (!*consumed) {
+          std::this_thread::yield();
+        }
+        *consumed = false;
+        if ((round + i) % 3 != 0) {
+          std::this_thread::sleep_for(std::chrono::microseconds(round % 50));
+        }
+        *ready_at = steady_clock::now().time_since_epoch().count();
+        target->UpdateRead(true);
+      }
+    });
+    threads.emplace_back(
+        [this, target, ready_at, consumed, &worst_us, &failures]() {
+          const vector<Target*> read_targets(1, target);
+          const struct timespec timeout = {2, 0};
+          for (int round = 0; round < kRounds; ++round) {
+            const auto result =
+                selector_.Select(read_targets, no_targets_, &timeout);
+            const auto woke = steady_clock::now().time_since_epoch().count();
+            if (result.size() != 1) {
+              ++failures;
+              return;
+            }
+            const long long latency_us =  // NOLINT(runtime/int)
+                duration_cast<std::chrono::microseconds>(
+                    steady_clock::duration(woke - *ready_at))
+                    .count();
+            long long seen = worst_us;  // NOLINT(runtime/int)
+            while (latency_us > seen &&
+                   !worst_us.compare_exchange_weak(seen, latency_us)) {
+            }
+            target->UpdateRead(false);
+            *consumed = true;
+          }
+        });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  printf("Selector stress worst-case wakeup latency: %lld us\n",
+         static_cast<long long>(worst_us));  // NOLINT(runtime/int)
+  EXPECT_EQ(0, failures);
+  EXPECT_LT(worst_us, 100 * 1000);
+}
+
+TEST_F(SelectorTest, AdaptiveSpinStillTimesOut) {
+  selector_.SetAdaptiveSpin(true);
+  // Train the inter-arrival estimate so that Select() spins.
+  for (int i = 0; i < 16; ++i) {
+    target_->UpdateRead(true);
+    target_->UpdateRead(false);
+  }
+  const struct timespec timeout = {0, 50 * 1000};
+  const auto start = steady_clock::now();
+  EXPECT_EQ(0, selector_.Select(read_targets_, no_targets_, &timeout).size());
+  EXPECT_LT(steady_clock::now() - start, milliseconds(100));
+}
+
+// Measures the delay between a notification and Select() returning, as seen
+// on the keystroke echo path, with and without adaptive spinning. Events
+// arrive every |kGapMicroseconds|, which is frequent enough to spin for.
+TEST_F(SelectorTest, AdaptiveSpinBenchmark) {
+  const int kRounds = 2000;
+  const int kGapMicroseconds = 100;
+  for (const bool spin : {false, true}) {
+    selector_.SetAdaptiveSpin(spin);
+    vector<long long> latencies_ns;  // NOLINT(runtime/int)
+    std::atomic<long long> ready_at(0);  // NOLINT(runtime/int)
+    std::atomic<bool> consumed(true);
+    std::atomic<bool> stop(false);
+    std::thread producer([&]() {
+      for (int round = 0; round < kRounds && !stop; ++round) {
+        while (!consumed && !stop) {
+          std::this_thread::yield();
+        }
+        consumed = false;
+        std::this_thread::sleep_for(
+            std::chrono::microseconds(kGapMicroseconds));
+        ready_at = steady_clock::now().time_since_epoch().count();
+        target_->UpdateRead(true);
+      }
+    });
+    const struct timespec timeout = {2, 0};
+    for (int round = 0; round < kRounds; ++round) {
+      // Don't return before joining |producer|; stop it instead.
+      const size_t ready =
+          selector_.Select(read_targets_, no_targets_, &timeout).size();
+      EXPECT_EQ(1, ready);
+      if (ready != 1) {
+        stop = true;
+        break;
+      }
+      const auto woke = steady_clock::now().time_since_epoch().count();
+      latencies_ns.push_back(
+          duration_cast<std::chrono::nanoseconds>(
+              steady_clock::duration(woke - ready_at))
+              .count());
+      target_->UpdateRead(false);
+      consumed = true;
+    }
+    producer.join();
+    if (stop) {
+      return;
+    }
+
+    std::sort(latencies_ns.begin(), latencies_ns.end());
+    printf("Selector wakeup latency, spin %s: p50 %lld ns, p99 %lld ns\n",
+           spin ? "on " : "off", latencies_ns[kRounds / 2],
+           latencies_ns[kRounds * 99 / 100]);
+  }
+}
+
+}  // namespace PepperPOSIX
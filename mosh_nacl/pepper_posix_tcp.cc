@@ -21,6 +21,8 @@
 #include "mosh_nacl/pepper_posix_tcp.h"
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
+#include <utility>
 
 namespace PepperPOSIX {
 
@@ -37,29 +39,42 @@ ssize_t Stream::Receive(void* buf, size_t count, int flags) {
   if (flags != 0) {
     Log("Stream::Receive(): Unsupported flag: 0x%x", flags);
   }
-  if (connection_errno_ != 0) {
-    errno = ECONNABORTED;
-    return -1;
-  }
-
-  pthread::MutexLock m(buffer_lock_);
   if (buffer_.size() == 0) {
+    if (connection_errno_ != 0) {
+      errno = connection_errno_;
+      return -1;
+    }
+    if (eof_) {
+      return 0;
+    }
     Log("Stream::Receive(): EWOULDBLOCK");
     errno = EWOULDBLOCK;
     return -1;
   }
   char* cbuf = reinterpret_cast<char*>(buf);
-  int read_count = 0;
-  if (peek) {
-    for (; read_count < count && read_count < buffer_.size(); ++read_count) {
-      *cbuf = buffer_[read_count];
-      ++cbuf;
-    }
-  } else {
-    for (; read_count < count && buffer_.size() > 0; ++read_count) {
-      *cbuf = buffer_.front();
+  size_t read_count = 0;
+  size_t offset = buffer_offset_;
+  for (auto chunk = buffer_.begin();
+       chunk != buffer_.end() && read_count < count; ++chunk) {
+    const size_t available = chunk->size() - offset;
+    const size_t to_copy =
+        available < count - read_count ? available : count - read_count;
+    memcpy(cbuf + read_count, chunk->data() + offset, to_copy);
+    read_count += to_copy;
+    offset = 0;
+  }
+
+  if (!peek) {
+    size_t consumed = read_count;
+    while (consumed > 0) {
+      const size_t available = buffer_.front().size() - buffer_offset_;
+      if (consumed < available) {
+        buffer_offset_ += consumed;
+        break;
+      }
+      consumed -= available;
       buffer_.pop_front();
-      ++cbuf;
+      buffer_offset_ = 0;
     }
     target_->UpdateRead(buffer_.size() > 0);
   }
@@ -75,16 +90,40 @@ ssize_t Stream::Write(const void* buf, size_t count) {
 
 void Stream::AddData(const void* buf, size_t count) {
   const char* cbuf = (const char*)buf;
+  AddData(std::vector<char>(cbuf, cbuf + count));
+}
 
-  {
-    pthread::MutexLock m(buffer_lock_);
-    for (; count > 0; --count) {
-      buffer_.push_back(*cbuf);
-      ++cbuf;
-    }
-  }
+void Stream::AddData(std::vector<char> data) {
+  Event event;
+  event.data = std::move(data);
+  PostEvent(std::move(event));
+}
+
+void Stream::AddEOF() {
+  Event event;
+  event.eof = true;
+  PostEvent(std::move(event));
+}
+
+void Stream::AddError(int error) {
+  Event event;
+  event.error = error;
+  PostEvent(std::move(event));
+}
 
-  target_->UpdateRead(true);
+void Stream::HandleEvent(Event event) {
+  if (event.data.size() > 0) {
+    buffer_.push_back(std::move(event.data));
+    target_->UpdateRead(true);
+  }
+  if (event.error != 0) {
+    connection_errno_ = event.error;
+    target_->UpdateError(true);
+  }
+  if (event.eof) {
+    eof_ = true;
+    target_->UpdateHangUp(true);
+  }
 }
 
 int StubTCP::Bind(__attribute__((unused)) const pp::NetAddress& address) {
@@ -97,6 +136,11 @@ int StubTCP::Connect(__attribute__((unused)) const pp::NetAddress& address) {
   return 0;
 }
 
+int StubTCP::GetPeerName(__attribute__((unused)) pp::NetAddress* address) {
+  Log("StubGetPeerName()");
+  return ENOTCONN;
+}
+
 ssize_t StubTCP::Send(__attribute__((unused)) const void* buf,
                       __attribute__((unused)) size_t count,
                       __attribute__((unused)) int flags) {
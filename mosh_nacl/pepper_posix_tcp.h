@@ -29,8 +29,8 @@
 #include <vector>
 
 #include "mosh_nacl/pepper_posix.h"
+#include "mosh_nacl/pepper_posix_event_queue.h"
 #include "mosh_nacl/pepper_posix_selector.h"
-#include "mosh_nacl/pthread_locks.h"
 
 #include "ppapi/cpp/net_address.h"
 
@@ -38,9 +38,9 @@ namespace PepperPOSIX {
 
 // Stream implements the basic POSIX emulation logic for SOCK_STREAM
 // communication. It is not fully implemented. An implementation should fully
-// implement Send(), and insert received data using AddData(). It is expected
-// that AddData() will be called from a different thread than the one calling
-// other methods; no other thread safety is provided.
+// implement Send(), and insert received data using AddData(). AddData() may be
+// called from a different thread than the one calling other methods; no other
+// thread safety is provided.
 class Stream : public ReadWriter {
  public:
   Stream();
@@ -58,18 +58,35 @@ class Stream : public ReadWriter {
   // Send replaces send().
   virtual ssize_t Send(const void* buf, size_t count, int flags) = 0;
 
-  // Connection status, errno-style.
+  // Connection status, errno-style. Only set it via AddError().
   int connection_errno_ = 0;
 
  protected:
   // AddData is used by the subclass to add data to the incoming buffer.
   // This method can be called from another thread than the one used to call
-  // the other methods. Takes ownership of *message and its associated buffers.
+  // the other methods. |buf| is copied; pass a vector to hand it over instead.
   void AddData(const void* buf, size_t count);
+  void AddData(std::vector<char> data);
+
+  // AddEOF marks the end of the incoming data, after anything already added.
+  // Once it has been read, Receive() returns 0. Can be called from another
+  // thread.
+  void AddEOF();
+
+  // AddError marks the connection as failed with the errno-style |error|,
+  // after anything already added. Once that has been read, Receive() fails
+  // with |error|. Can be called from another thread.
+  void AddError(int error);
+
+  // Buffers the data delivered by the POSIX event queue.
+  void HandleEvent(Event event) override;
 
  private:
-  std::deque<char> buffer_;  // Guard with buffer_lock_.
-  pthread::Mutex buffer_lock_;
+  // Received data, in the chunks it arrived in. |buffer_offset_| bytes of the
+  // front chunk have already been read.
+  std::deque<std::vector<char>> buffer_;
+  size_t buffer_offset_ = 0;
+  bool eof_ = false;
 
   // Disable copy and assignment.
   Stream(const Stream&) = delete;
@@ -85,6 +102,10 @@ class TCP : public Stream {
 
   // Connect replaces connect().
   virtual int Connect(const pp::NetAddress& address) = 0;
+
+  // Gets the address of the connected peer, for getpeername(). Returns an
+  // errno-style error, such as ENOTCONN, on failure.
+  virtual int GetPeerName(pp::NetAddress* address) = 0;
 };
 
 // UnixSocketStream adds to Stream the interfaces specific to Unix domain
@@ -107,6 +128,7 @@ class StubTCP : public TCP {
   ssize_t Send(const void* buf, size_t count, int flags) override;
   int Bind(const pp::NetAddress& address) override;
   int Connect(const pp::NetAddress& address) override;
+  int GetPeerName(pp::NetAddress* address) override;
 
  private:
   // Disable copy and assignment.
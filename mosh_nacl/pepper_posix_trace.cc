@@ -0,0 +1,164 @@
+// pepper_posix_trace.cc - Records POSIX I/O for replay.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/pepper_posix_trace.h"
+
+#include <time.h>
+#include <utility>
+
+using std::string;
+using std::vector;
+
+namespace PepperPOSIX {
+
+const char IOTrace::kMagic[8] = {'M', 'O', 'S', 'H', 'T', 'R', 'C', '1'};
+
+namespace {
+
+// The most a record header can take: a kind byte and four 10-byte varints.
+const size_t kMaxHeaderSize = 1 + 4 * 10;
+
+void PutVarint(uint64_t value, string* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+void PutSigned(int64_t value, string* out) {
+  PutVarint((static_cast<uint64_t>(value) << 1) ^ (value >> 63), out);
+}
+
+// Reads a varint at |*pos|, advancing it. Returns false if |data| ends first.
+bool GetVarint(const string& data, size_t* pos, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && *pos < data.size(); shift += 7) {
+    const uint8_t byte = data[(*pos)++];
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool GetSigned(const string& data, size_t* pos, int64_t* value) {
+  uint64_t zigzag;
+  if (!GetVarint(data, pos, &zigzag)) {
+    return false;
+  }
+  *value =
+      static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+  return true;
+}
+
+int64_t Microseconds(const struct timespec& time) {
+  return time.tv_sec * 1000000LL + time.tv_nsec / 1000;
+}
+
+int64_t Now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return Microseconds(now);
+}
+
+}  // anonymous namespace
+
+IOTrace::IOTrace(size_t max_size) : max_size_(max_size) {
+  data_.append(kMagic, sizeof(kMagic));
+}
+
+void IOTrace::Add(int64_t time, TraceRecord::Kind kind, int fd, int32_t value,
+                  const void* data, size_t size) {
+  pthread::MutexLock m(lock_);
+  if (data_.size() + kMaxHeaderSize + size > max_size_) {
+    ++dropped_;
+    return;
+  }
+  data_.push_back(static_cast<char>(kind));
+  PutSigned(time - last_time_, &data_);
+  last_time_ = time;
+  PutSigned(fd, &data_);
+  PutSigned(value, &data_);
+  PutVarint(size, &data_);
+  data_.append(static_cast<const char*>(data), size);
+}
+
+void IOTrace::AddEvent(const Event& event) {
+  const int64_t time = Microseconds(event.enqueued);
+  if (!event.data.empty()) {
+    Add(time, TraceRecord::RECEIVE, event.fd, 0, event.data.data(),
+        event.data.size());
+  }
+  if (event.error != 0) {
+    Add(time, TraceRecord::ERROR, event.fd, event.error, nullptr, 0);
+  } else if (event.eof) {
+    Add(time, TraceRecord::END, event.fd, 0, nullptr, 0);
+  }
+}
+
+void IOTrace::AddSend(int fd, const void* buf, ssize_t count) {
+  if (count > 0) {
+    Add(Now(), TraceRecord::SEND, fd, 0, buf, count);
+  }
+}
+
+void IOTrace::AddWindowChange(int width, int height) {
+  Add(Now(), TraceRecord::WINDOW_CHANGE, -1, width << 16 | height, nullptr, 0);
+}
+
+string IOTrace::data() const {
+  pthread::MutexLock m(lock_);
+  return data_;
+}
+
+uint64_t IOTrace::dropped() const {
+  pthread::MutexLock m(lock_);
+  return dropped_;
+}
+
+bool IOTrace::Parse(const string& trace, vector<TraceRecord>* records) {
+  records->clear();
+  if (trace.compare(0, sizeof(kMagic), string(kMagic, sizeof(kMagic))) != 0) {
+    return false;
+  }
+  int64_t time = 0;
+  size_t pos = sizeof(kMagic);
+  while (pos < trace.size()) {
+    TraceRecord record;
+    const uint8_t kind = trace[pos++];
+    int64_t delta, fd, value;
+    uint64_t size;
+    if (kind >= TraceRecord::NUM_KINDS || !GetSigned(trace, &pos, &delta) ||
+        !GetSigned(trace, &pos, &fd) || !GetSigned(trace, &pos, &value) ||
+        !GetVarint(trace, &pos, &size) || size > trace.size() - pos) {
+      return false;
+    }
+    time += delta;
+    record.time = time;
+    record.kind = static_cast<TraceRecord::Kind>(kind);
+    record.fd = fd;
+    record.value = value;
+    record.data.assign(trace.begin() + pos, trace.begin() + pos + size);
+    pos += size;
+    records->push_back(std::move(record));
+  }
+  return true;
+}
+
+}  // namespace PepperPOSIX
@@ -0,0 +1,103 @@
+// pepper_posix_trace.h - Records POSIX I/O for replay.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MOSH_NACL_PEPPER_POSIX_TRACE_H_
+#define MOSH_NACL_PEPPER_POSIX_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+#include "mosh_nacl/pepper_posix_event_queue.h"
+#include "mosh_nacl/pthread_locks.h"
+
+namespace PepperPOSIX {
+
+// TraceRecord is one step of I/O between a program and POSIX.
+struct TraceRecord {
+  enum Kind {
+    RECEIVE = 0,    // Inbound data arrived for |fd|.
+    END,            // The stream on |fd| ended.
+    ERROR,          // The stream on |fd| failed with errno |value|.
+    SEND,           // The program wrote |data| to |fd|.
+    WINDOW_CHANGE,  // The window became (|value| >> 16) x (|value| & 0xffff).
+    NUM_KINDS,
+  };
+
+  int64_t time = 0;  // Microseconds, on CLOCK_MONOTONIC.
+  Kind kind = RECEIVE;
+  int fd = -1;
+  int32_t value = 0;
+  std::vector<char> data;
+};
+
+// IOTrace records the I/O of a session in a compact binary form, for
+// reproducing it offline with trace_replay. Inbound records are timestamped
+// when the data arrived (when its Event was queued), outbound ones when the
+// program wrote them. Once the trace reaches |max_size| bytes, further records
+// are only counted. Can be called from any thread.
+//
+// The trace is a magic number followed by records, each of which is a kind
+// byte and then, as varints, the time since the previous record, the fd, the
+// value, and the size of the data that follows. Signed fields are zigzag
+// encoded.
+class IOTrace {
+ public:
+  static const char kMagic[8];
+
+  explicit IOTrace(size_t max_size);
+  IOTrace(const IOTrace&) = delete;
+  IOTrace& operator=(const IOTrace&) = delete;
+  ~IOTrace() = default;
+
+  void Add(int64_t time, TraceRecord::Kind kind, int fd, int32_t value,
+           const void* data, size_t size);
+
+  // Records what |event| delivers to its File.
+  void AddEvent(const Event& event);
+
+  // Records a write of |count| bytes from |buf|, if any were written.
+  void AddSend(int fd, const void* buf, ssize_t count);
+
+  // Records a window size change.
+  void AddWindowChange(int width, int height);
+
+  // The encoded trace so far.
+  std::string data() const;
+
+  // Count of records not kept because the trace was full.
+  uint64_t dropped() const;
+
+  // Decodes |trace| into |*records|. Returns false if it is malformed; the
+  // records before the damage are kept.
+  static bool Parse(const std::string& trace,
+                    std::vector<TraceRecord>* records);
+
+ private:
+  const size_t max_size_;
+  // Guard these with lock_.
+  std::string data_;
+  int64_t last_time_ = 0;
+  uint64_t dropped_ = 0;
+  mutable pthread::Mutex lock_;
+};
+
+}  // namespace PepperPOSIX
+
+#endif  // MOSH_NACL_PEPPER_POSIX_TRACE_H_
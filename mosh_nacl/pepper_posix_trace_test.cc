@@ -0,0 +1,100 @@
+// pepper_posix_trace_test.cc - Tests for the POSIX I/O trace.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/pepper_posix_trace.h"
+
+#include <errno.h>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::string;
+using std::vector;
+
+namespace PepperPOSIX {
+
+TEST(IOTraceTest, RoundTrip) {
+  IOTrace trace(1 << 20);
+  trace.Add(5000000000LL, TraceRecord::SEND, 3, 0, "hello", 5);
+  Event event;
+  event.fd = 4;
+  event.data = {'a', 'b'};
+  event.eof = true;
+  event.enqueued = {4, 999000};  // Before the SEND; times can go backward.
+  trace.AddEvent(event);
+  trace.Add(5000000001LL, TraceRecord::ERROR, 5, ECONNRESET, nullptr, 0);
+  trace.Add(5000000002LL, TraceRecord::WINDOW_CHANGE, -1, 80 << 16 | 24,
+            nullptr, 0);
+
+  vector<TraceRecord> records;
+  ASSERT_TRUE(IOTrace::Parse(trace.data(), &records));
+  ASSERT_EQ(5, records.size());
+  EXPECT_EQ(TraceRecord::SEND, records[0].kind);
+  EXPECT_EQ(5000000000LL, records[0].time);
+  EXPECT_EQ(3, records[0].fd);
+  EXPECT_EQ("hello", string(records[0].data.begin(), records[0].data.end()));
+  EXPECT_EQ(TraceRecord::RECEIVE, records[1].kind);
+  EXPECT_EQ(4000999, records[1].time);
+  EXPECT_EQ(4, records[1].fd);
+  EXPECT_EQ(2, records[1].data.size());
+  EXPECT_EQ(TraceRecord::END, records[2].kind);
+  EXPECT_EQ(TraceRecord::ERROR, records[3].kind);
+  EXPECT_EQ(ECONNRESET, records[3].value);
+  EXPECT_EQ(TraceRecord::WINDOW_CHANGE, records[4].kind);
+  EXPECT_EQ(-1, records[4].fd);
+  EXPECT_EQ(80, records[4].value >> 16);
+  EXPECT_EQ(5000000002LL, records[4].time);
+}
+
+TEST(IOTraceTest, IsCompact) {
+  IOTrace trace(1 << 20);
+  const size_t empty_size = trace.data().size();
+  for (int i = 0; i < 100; ++i) {
+    trace.Add(1000000 + i * 100, TraceRecord::SEND, 3, 0, "x", 1);
+  }
+  // A kind byte, four small varints, and the byte itself, after the first.
+  EXPECT_GE(empty_size + 100 * 7 + 4, trace.data().size());
+}
+
+TEST(IOTraceTest, StopsWhenFull) {
+  IOTrace trace(100);
+  const string data(30, 'x');
+  for (int i = 0; i < 5; ++i) {
+    trace.Add(i, TraceRecord::SEND, 3, 0, data.data(), data.size());
+  }
+  EXPECT_LE(trace.data().size(), 100);
+  EXPECT_EQ(4, trace.dropped());
+  vector<TraceRecord> records;
+  ASSERT_TRUE(IOTrace::Parse(trace.data(), &records));
+  EXPECT_EQ(1, records.size());
+}
+
+TEST(IOTraceTest, RejectsDamage) {
+  IOTrace trace(1 << 20);
+  trace.Add(1, TraceRecord::SEND, 3, 0, "abc", 3);
+  trace.Add(2, TraceRecord::SEND, 3, 0, "def", 3);
+  string data = trace.data();
+  vector<TraceRecord> records;
+  EXPECT_FALSE(IOTrace::Parse(data.substr(0, data.size() - 1), &records));
+  EXPECT_EQ(1, records.size());
+  EXPECT_FALSE(IOTrace::Parse("not a trace", &records));
+  data[sizeof(IOTrace::kMagic)] = TraceRecord::NUM_KINDS;
+  EXPECT_FALSE(IOTrace::Parse(data, &records));
+}
+
+}  // namespace PepperPOSIX
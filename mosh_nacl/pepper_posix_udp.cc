@@ -23,25 +23,162 @@
 #include <errno.h>
 #include <netinet/in.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 #include <utility>
 
 namespace PepperPOSIX {
 
-using std::unique_ptr;
-using std::vector;
+using std::move;
 
-MsgHdr::MsgHdr(const pp::NetAddress& addr, int32_t size,
-               const char* const buf) {
-  memset(this, 0, sizeof(*this));
+UDP::UDP() {}
+
+UDP::~UDP() {}
+
+ssize_t UDP::Receive(struct ::msghdr* message,
+                     __attribute((unused)) int flags) {
+  if (packets_.size() == 0) {
+    errno = EWOULDBLOCK;
+    return -1;
+  }
+  Event latest = move(packets_.front());
+  packets_.pop_front();
+  target_->UpdateRead(packets_.size() > 0);
+
+  if (message->msg_namelen >= latest.address_len) {
+    memcpy(message->msg_name, &latest.address, latest.address_len);
+  } else {
+    Log("UDP::Receive(): msg_namelen too short.");
+  }
+
+  ssize_t size = 0;
+  const size_t input_len = latest.data.size();
+  for (int i = 0; i < message->msg_iovlen && size < input_len; ++i) {
+    size_t output_len = message->msg_iov[i].iov_len;
+    size_t to_copy =
+        output_len <= input_len - size ? output_len : input_len - size;
+    memcpy(message->msg_iov[i].iov_base, latest.data.data() + size, to_copy);
+    size += to_copy;
+  }
+  assert(size ==
+         input_len);  // TODO(rpwoodbu): Return a real error, or handle better.
+
+  // TODO(rpwoodbu): Ignoring flags, msg_flags, and msg_control for now.
+
+  return size;
+}
+
+namespace {
+
+// Compares only the meaningful fields of two sockaddrs; padding such as
+// sin_zero is not guaranteed to be initialized by callers.
+bool IsSameSockAddr(const struct sockaddr* a, const struct sockaddr* b) {
+  if (a->sa_family != b->sa_family) {
+    return false;
+  }
+  switch (a->sa_family) {
+    case AF_INET: {
+      const auto* a_in = reinterpret_cast<const struct sockaddr_in*>(a);
+      const auto* b_in = reinterpret_cast<const struct sockaddr_in*>(b);
+      return a_in->sin_port == b_in->sin_port &&
+             a_in->sin_addr.s_addr == b_in->sin_addr.s_addr;
+    }
+    case AF_INET6: {
+      const auto* a_in6 = reinterpret_cast<const struct sockaddr_in6*>(a);
+      const auto* b_in6 = reinterpret_cast<const struct sockaddr_in6*>(b);
+      return a_in6->sin6_port == b_in6->sin6_port &&
+             memcmp(a_in6->sin6_addr.s6_addr, b_in6->sin6_addr.s6_addr,
+                    sizeof(a_in6->sin6_addr.s6_addr)) == 0;
+    }
+    default:
+      return false;
+  }
+}
+
+// Returns the size of the sockaddr of |addr|'s family, or 0 if |addrlen| is
+// too short or the family is unsupported.
+socklen_t SockAddrSize(const struct sockaddr* addr, socklen_t addrlen) {
+  socklen_t size = 0;
+  switch (addr->sa_family) {
+    case AF_INET:
+      size = sizeof(struct sockaddr_in);
+      break;
+    case AF_INET6:
+      size = sizeof(struct sockaddr_in6);
+      break;
+    default:
+      return 0;
+  }
+  return addrlen >= size ? size : 0;
+}
+
+}  // anonymous namespace
+
+const pp::NetAddress* UDP::CachedAddress(const struct sockaddr* addr,
+                                         socklen_t addrlen) const {
+  if (!has_cached_address_ || SockAddrSize(addr, addrlen) == 0) {
+    return nullptr;
+  }
+  if (!IsSameSockAddr(addr, &cached_sockaddr_.sa)) {
+    return nullptr;
+  }
+  return &cached_address_;
+}
+
+void UDP::CacheAddress(const struct sockaddr* addr, socklen_t addrlen,
+                       const pp::NetAddress& address) {
+  const socklen_t size = SockAddrSize(addr, addrlen);
+  if (size == 0) {
+    return;
+  }
+  if (connected_ && !IsSameSockAddr(addr, &cached_sockaddr_.sa)) {
+    // Keep the connected destination; it is the one that will be reused.
+    return;
+  }
+  memcpy(&cached_sockaddr_, addr, size);
+  cached_address_ = address;
+  has_cached_address_ = true;
+}
+
+int UDP::CheckAddress(const struct sockaddr* addr, socklen_t addrlen) {
+  if (addr == nullptr || addrlen < sizeof(addr->sa_family)) {
+    return EINVAL;
+  }
+  if (addr->sa_family != AF_INET && addr->sa_family != AF_INET6) {
+    return EAFNOSUPPORT;
+  }
+  if (SockAddrSize(addr, addrlen) == 0) {
+    return EINVAL;
+  }
+  return 0;
+}
+
+int UDP::Connect(const struct sockaddr* addr, socklen_t addrlen,
+                 const pp::NetAddress& address) {
+  connected_ = false;
+  const int error = CheckAddress(addr, addrlen);
+  if (error != 0) {
+    errno = error;
+    return -1;
+  }
+  CacheAddress(addr, addrlen, address);
+  connected_ = true;
+  return 0;
+}
+
+void UDP::AddPacket(const pp::NetAddress& addr, const void* buf,
+                    size_t count) {
+  const char* cbuf = static_cast<const char*>(buf);
+  AddPacket(addr, std::vector<char>(cbuf, cbuf + count));
+}
+
+void UDP::AddPacket(const pp::NetAddress& addr, std::vector<char> data) {
+  Event event;
 
   switch (addr.GetFamily()) {
     case PP_NETADDRESS_FAMILY_IPV4: {
       PP_NetAddress_IPv4 ipv4_addr;
       assert(addr.DescribeAsIPv4Address(&ipv4_addr));
-      struct sockaddr_in* saddr =
-          (struct sockaddr_in*)malloc(sizeof(struct sockaddr_in));
+      struct sockaddr_in* saddr = &event.address.in;
       saddr->sin_family = AF_INET;
       saddr->sin_port = ipv4_addr.port;
       uint32_t a = 0;
@@ -49,21 +186,18 @@ MsgHdr::MsgHdr(const pp::NetAddress& addr, int32_t size,
         a |= ipv4_addr.addr[i] << (8 * i);
       }
       saddr->sin_addr.s_addr = a;
-      msg_name = saddr;
-      msg_namelen = sizeof(*saddr);
+      event.address_len = sizeof(*saddr);
     } break;
 
     case PP_NETADDRESS_FAMILY_IPV6: {
       PP_NetAddress_IPv6 ipv6_addr;
       assert(addr.DescribeAsIPv6Address(&ipv6_addr));
-      struct sockaddr_in6* saddr =
-          (struct sockaddr_in6*)malloc(sizeof(struct sockaddr_in6));
+      struct sockaddr_in6* saddr = &event.address.in6;
       saddr->sin6_family = AF_INET6;
       saddr->sin6_port = ipv6_addr.port;
       memcpy(saddr->sin6_addr.s6_addr, ipv6_addr.addr,
              sizeof(saddr->sin6_addr.s6_addr));
-      msg_name = saddr;
-      msg_namelen = sizeof(*saddr);
+      event.address_len = sizeof(*saddr);
     } break;
 
     default:
@@ -72,84 +206,61 @@ MsgHdr::MsgHdr(const pp::NetAddress& addr, int32_t size,
       break;
   }
 
-  msg_iov = (struct iovec*)malloc(sizeof(struct iovec));
-  msg_iovlen = 1;
-  msg_iov->iov_base = malloc(size);
-  msg_iov->iov_len = size;
-  memcpy(msg_iov->iov_base, buf, msg_iov->iov_len);
+  event.data = move(data);
+  DeliverPacket(move(event));
 }
 
-MsgHdr::~MsgHdr() {
-  free(msg_name);
-  for (int i = 0; i < msg_iovlen; ++i) {
-    free(msg_iov[i].iov_base);
-    free(msg_iov + i);
+void UDP::DeliverPacket(Event event) {
+  if (sink_) {
+    sink_(move(event));
+    return;
   }
-  assert(msg_control == nullptr);  // This isn't being used.
+  PostEvent(move(event));
 }
 
-UDP::UDP() {}
-
-UDP::~UDP() {
-  // There really shouldn't be another thread actively involved at destruction
-  // time, but getting the lock nonetheless.
-  pthread::MutexLock m(packets_lock_);
-  packets_.clear();
+void UDP::HandleEvent(Event event) {
+  packets_.push_back(move(event));
+  target_->UpdateRead(true);
 }
 
-ssize_t UDP::Receive(struct ::msghdr* message,
-                     __attribute((unused)) int flags) {
-  unique_ptr<MsgHdr> latest;
+TracedUDP::TracedUDP(std::unique_ptr<UDP> udp,
+                     std::function<void(bool sent)> hook)
+    : udp_(move(udp)), hook_(hook) {
+  udp_->SetPacketSink([this](Event event) {
+    hook_(false);
+    DeliverPacket(move(event));
+  });
+}
 
-  {
-    pthread::MutexLock m(packets_lock_);
-    if (packets_.size() == 0) {
-      errno = EWOULDBLOCK;
-      return -1;
-    }
-    latest = move(packets_.front());
-    packets_.pop_front();
-    target_->UpdateRead(packets_.size() > 0);
-  }
+TracedUDP::~TracedUDP() {}
 
-  if (message->msg_namelen >= latest->msg_namelen) {
-    memcpy(message->msg_name, latest->msg_name, latest->msg_namelen);
-  } else {
-    Log("UDP::Receive(): msg_namelen too short.");
-  }
+int TracedUDP::Bind(const pp::NetAddress& address) {
+  return udp_->Bind(address);
+}
 
-  assert(latest->msg_iovlen == 1);  // For simplicity, as this is internal.
-  ssize_t size = 0;
-  size_t input_len = latest->msg_iov->iov_len;
-  for (int i = 0; i < message->msg_iovlen && size < input_len; ++i) {
-    size_t output_len = message->msg_iov[i].iov_len;
-    size_t to_copy = output_len <= input_len ? output_len : input_len;
-    memcpy(message->msg_iov[i].iov_base, latest->msg_iov->iov_base, to_copy);
-    size += to_copy;
-  }
-  assert(size ==
-         input_len);  // TODO(rpwoodbu): Return a real error, or handle better.
+ssize_t TracedUDP::Send(const void* buf, size_t count, int flags,
+                        const pp::NetAddress& address) {
+  hook_(true);
+  return udp_->Send(buf, count, flags, address);
+}
 
-  // TODO(rpwoodbu): Ignoring flags, msg_flags, and msg_control for now.
+int TracedUDP::Close() { return udp_->Close(); }
 
-  return size;
+int TracedUDP::SetSockOpt(int level, int optname, int value) {
+  return udp_->SetSockOpt(level, optname, value);
 }
 
-void UDP::AddPacket(unique_ptr<MsgHdr> message) {
-  {
-    pthread::MutexLock m(packets_lock_);
-    packets_.push_back(move(message));
-  }
-  target_->UpdateRead(true);
+int TracedUDP::GetSockOpt(int level, int optname, int* value) {
+  return udp_->GetSockOpt(level, optname, value);
 }
 
-ssize_t StubUDP::Send(const vector<char>& buf,
+ssize_t StubUDP::Send(const void* buf, size_t count,
                       __attribute__((unused)) int flags,
-                      __attribute__((unused)) const pp::NetAddress& addr) {
-  Log("StubUDP::Send(): size=%d", buf.size());
+                      const pp::NetAddress& addr) {
+  Log("StubUDP::Send(): size=%d", count);
   Log("StubUDP::Send(): Pretending we received something.");
-  AddPacket(nullptr);
-  return buf.size();
+  AddPacket(addr, buf, count);
+  return count;
 }
 
 int StubUDP::Bind(__attribute__((unused)) const pp::NetAddress& address) {
@@ -21,37 +21,28 @@
 #ifndef MOSH_NACL_PEPPER_POSIX_UDP_H_
 #define MOSH_NACL_PEPPER_POSIX_UDP_H_
 
+#include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <deque>
+#include <functional>
 #include <memory>
 #include <vector>
 
 #include "mosh_nacl/pepper_posix.h"
+#include "mosh_nacl/pepper_posix_event_queue.h"
 #include "mosh_nacl/pepper_posix_selector.h"
-#include "mosh_nacl/pthread_locks.h"
 
 #include "ppapi/cpp/net_address.h"
 
 namespace PepperPOSIX {
 
-// Wrapper over struct msghdr, which ensures proper destruction.
-struct MsgHdr : public ::msghdr {
-  MsgHdr() = delete;
-  MsgHdr(const pp::NetAddress& addr, int32_t size, const char* const buf);
-  ~MsgHdr();
-
-  // Disable copy and assignment.
-  MsgHdr(const MsgHdr&) = delete;
-  MsgHdr& operator=(const MsgHdr&) = delete;
-};
-
 // UDP implements the basic POSIX emulation logic for UDP communication. It is
 // not fully implemented. An implementation should fully implement Bind() and
-// Send(), and insert received packets using AddPacket(). It is expected that
-// AddPacket() will be called from a different thread than the one calling the
-// other methods; no other thread safety is provided.
+// Send(), and insert received packets using AddPacket(). AddPacket() may be
+// called from a different thread than the one calling the other methods; no
+// other thread safety is provided.
 class UDP : public File {
  public:
   UDP();
@@ -63,25 +54,103 @@ class UDP : public File {
   // Bind replaces bind().
   virtual int Bind(const pp::NetAddress& address) = 0;
 
-  // Send replaces sendto(). Usage is similar, but tweaked for C++.
-  virtual ssize_t Send(const std::vector<char>& buf, int flags,
+  // Send replaces sendto(). Usage is similar, but tweaked for C++. |buf| is
+  // only borrowed for the duration of the call; implementations must not
+  // retain it.
+  virtual ssize_t Send(const void* buf, size_t count, int flags,
                        const pp::NetAddress& address) = 0;
 
+  // Returns the pp::NetAddress previously cached for |addr| by
+  // CacheAddress(), or nullptr if |addr| is not the cached destination.
+  // Creating a pp::NetAddress allocates a browser resource, and Mosh sends
+  // every datagram to the same peer, so one entry is all that is needed.
+  const pp::NetAddress* CachedAddress(const struct sockaddr* addr,
+                                      socklen_t addrlen) const;
+
+  // Remembers |address| as the pp::NetAddress for |addr|, replacing any
+  // previously cached destination.
+  void CacheAddress(const struct sockaddr* addr, socklen_t addrlen,
+                    const pp::NetAddress& address);
+
+  // Checks that |addr| is an address UDP can use. Returns 0 if so, otherwise
+  // the errno connect() or sendto() should fail with.
+  static int CheckAddress(const struct sockaddr* addr, socklen_t addrlen);
+
+  // Connect replaces connect(). It only sets the default destination, which
+  // is also kept in the address cache. |address| is not used if |addr| fails
+  // CheckAddress(). On failure, the socket is left unconnected.
+  int Connect(const struct sockaddr* addr, socklen_t addrlen,
+              const pp::NetAddress& address);
+
+  // The default destination set by Connect(), or nullptr if not connected.
+  const pp::NetAddress* connected_address() const {
+    return connected_ ? &cached_address_ : nullptr;
+  }
+
+  // Hands packets from AddPacket() to |sink|, on the thread that added them,
+  // instead of queueing them here. This lets a wrapping UDP take the packets
+  // of one that is not registered with POSIX. Set it before binding.
+  void SetPacketSink(std::function<void(Event)> sink) { sink_ = sink; }
+
  protected:
-  // AddPacket is used by the subclass to add a packet to the incoming queue.
-  // This method can be called from another thread than the one used to call
-  // the other methods. Takes ownership of *message and its associated buffers.
-  void AddPacket(std::unique_ptr<MsgHdr> message);
+  // AddPacket is used by the subclass to add a packet from |addr| to the
+  // incoming queue. This method can be called from another thread than the
+  // one used to call the other methods. |buf| is copied; pass a vector to
+  // hand it over instead.
+  void AddPacket(const pp::NetAddress& addr, const void* buf, size_t count);
+  void AddPacket(const pp::NetAddress& addr, std::vector<char> data);
+
+  // DeliverPacket passes on a received |event| as AddPacket() does, to the
+  // sink or to POSIX. For wrappers passing on the packets of the UDP they
+  // wrap.
+  void DeliverPacket(Event event);
+
+  // Queues the packet delivered by the POSIX event queue.
+  void HandleEvent(Event event) override;
 
  private:
-  std::deque<std::unique_ptr<MsgHdr>> packets_;  // Guard with packets_lock_.
-  pthread::Mutex packets_lock_;
+  std::deque<Event> packets_;
+  std::function<void(Event)> sink_;
+
+  // Destination cache; see CachedAddress().
+  union {
+    struct sockaddr sa;
+    struct sockaddr_in in;
+    struct sockaddr_in6 in6;
+  } cached_sockaddr_;
+  bool has_cached_address_ = false;
+  pp::NetAddress cached_address_;
+  bool connected_ = false;
 
   // Disable copy and assignment.
   UDP(const UDP&) = delete;
   UDP& operator=(const UDP&) = delete;
 };
 
+// TracedUDP wraps another UDP implementation, and calls |hook| with true for
+// each packet sent, and with false for each one received (on the thread that
+// received it). The wrapped UDP must not be registered with POSIX.
+class TracedUDP : public UDP {
+ public:
+  TracedUDP(std::unique_ptr<UDP> udp, std::function<void(bool sent)> hook);
+  ~TracedUDP() override;
+
+  int Bind(const pp::NetAddress& address) override;
+  ssize_t Send(const void* buf, size_t count, int flags,
+               const pp::NetAddress& address) override;
+  int Close() override;
+  int SetSockOpt(int level, int optname, int value) override;
+  int GetSockOpt(int level, int optname, int* value) override;
+
+ private:
+  std::unique_ptr<UDP> udp_;
+  std::function<void(bool sent)> hook_;
+
+  // Disable copy and assignment.
+  TracedUDP(const TracedUDP&) = delete;
+  TracedUDP& operator=(const TracedUDP&) = delete;
+};
+
 // StubUDP is an instantiatable stubbed subclass of UDP for debugging.
 class StubUDP : public UDP {
  public:
@@ -89,7 +158,7 @@ class StubUDP : public UDP {
   int Bind(const pp::NetAddress& address) override;
 
   // Send replaces sendto. Usage is similar, but tweaked for C++.
-  ssize_t Send(const std::vector<char>& buf, int flags,
+  ssize_t Send(const void* buf, size_t count, int flags,
                const pp::NetAddress& address) override;
 
  private:
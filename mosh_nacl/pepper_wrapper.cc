@@ -215,63 +215,13 @@ int fileno(FILE* stream) {
 //   return result;
 // }
 
-// Fake getaddrinfo(), as we expect it will always be an IP address and numeric
-// port.
 int getaddrinfo(const char* node, const char* service,
                 const struct addrinfo* hints, struct addrinfo** res) {
-  if (hints->ai_flags & AI_CANONNAME) {
-    Log("getaddrinfo(): AI_CANONNAME not implemented.");
-    return EAI_FAIL;
-  }
-
-  struct sockaddr* addr;
-  size_t addr_size;
-  uint32_t ip4_addr;
-  unsigned char ip6_addr[16];
-
-  if (inet_pton(AF_INET, node, &ip4_addr) == 1) {
-    struct sockaddr_in* addr_in = new sockaddr_in;
-    memset(addr_in, 0, sizeof(*addr_in));
-    addr_in->sin_family = AF_INET;
-    addr_in->sin_addr.s_addr = ip4_addr;
-    addr_in->sin_port = htons(atoi(service));
-    addr = (struct sockaddr*)addr_in;
-    addr_size = sizeof(*addr_in);
-  } else if (inet_pton(AF_INET6, node, &ip6_addr) == 1) {
-    struct sockaddr_in6* addr_in = new sockaddr_in6;
-    memset(addr_in, 0, sizeof(*addr_in));
-    addr_in->sin6_family = AF_INET6;
-    memcpy(addr_in->sin6_addr.s6_addr, ip6_addr,
-           sizeof(addr_in->sin6_addr.s6_addr));
-    addr_in->sin6_port = htons(atoi(service));
-    addr = (struct sockaddr*)addr_in;
-    addr_size = sizeof(*addr_in);
-  } else {
-    Log("getaddrinfo(): Cannot parse address.");
-    return EAI_FAIL;
-  }
-
-  struct addrinfo* ai = new struct addrinfo;
-  memset(ai, 0, sizeof(*ai));
-  ai->ai_addr = addr;
-  ai->ai_addrlen = addr_size;
-  ai->ai_family = addr->sa_family;
-  if (hints != nullptr) {
-    ai->ai_protocol = hints->ai_protocol;
-    ai->ai_socktype = hints->ai_socktype;
-  }
-
-  *res = ai;
-  return 0;
+  return GetPOSIX().GetAddrInfo(node, service, hints, res);
 }
 
 void freeaddrinfo(struct addrinfo* res) {
-  while (res != nullptr) {
-    struct addrinfo* last = res;
-    delete res->ai_addr;
-    res = res->ai_next;
-    delete last;
-  }
+  PepperPOSIX::POSIX::FreeAddrInfo(res);
 }
 
 #ifdef USE_NEWLIB
@@ -314,10 +264,10 @@ int bind(int sockfd, UNUSED const struct sockaddr* addr,
   return -1;
 }
 
-// Most socket options aren't supported by PPAPI, so just stubbing out.
-int setsockopt(UNUSED int sockfd, UNUSED int level, UNUSED int optname,
-               UNUSED const void* optval, UNUSED socklen_t optlen) {
-  return 0;
+// Options that PPAPI has no equivalent for are accepted and ignored.
+int setsockopt(int sockfd, int level, int optname, const void* optval,
+               socklen_t optlen) {
+  return GetPOSIX().SetSockOpt(sockfd, level, optname, optval, optlen);
 }
 
 // This is needed to return TCP connection status.
@@ -326,6 +276,10 @@ int getsockopt(int sockfd, int level, int optname, void* optval,
   return GetPOSIX().GetSockOpt(sockfd, level, optname, optval, optlen);
 }
 
+int getpeername(int sockfd, struct sockaddr* addr, socklen_t* addrlen) {
+  return GetPOSIX().GetPeerName(sockfd, addr, addrlen);
+}
+
 int dup(int oldfd) { return GetPOSIX().Dup(oldfd); }
 
 int pselect(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds,
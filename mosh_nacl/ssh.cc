@@ -150,6 +150,11 @@ Key& Session::GetPublicKey() {
     return auth_types;
   }
 
+  return GetRemainingAuthenticationTypes();
+}
+
+::std::vector<AuthenticationType> Session::GetRemainingAuthenticationTypes() {
+  ::std::vector<AuthenticationType> auth_types;
   int auth_list = ssh_userauth_list(s_, nullptr);
   if (auth_list & SSH_AUTH_METHOD_PASSWORD) {
     auth_types.push_back(AuthenticationType::kPassword);
@@ -305,6 +310,7 @@ bool Key::ImportPrivateKey(const string& key, const char* passphrase) {
     ssh_key_free(key_);
     key_ = nullptr;
   }
+  digests_.clear();
   int result = ssh_pki_import_privkey_base64(key.c_str(), passphrase, nullptr,
                                              nullptr, &key_);
   if (result != SSH_OK) {
@@ -318,6 +324,7 @@ bool Key::ImportPublicKey(const string& key, KeyType type) {
     ssh_key_free(key_);
     key_ = nullptr;
   }
+  digests_.clear();
   int result = ssh_pki_import_pubkey_base64(key.c_str(), type.type_, &key_);
   if (result != SSH_OK) {
     return false;
@@ -345,20 +352,34 @@ string Key::SHA1() const { return Hash(SSH_PUBLICKEY_HASH_SHA1); }
 
 string Key::SHA256() const { return Hash(SSH_PUBLICKEY_HASH_SHA256); }
 
-string Key::Hash(const ssh_publickey_hash_type type) const {
+const string& Key::Digest(const ssh_publickey_hash_type type) const {
+  auto iter = digests_.find(type);
+  if (iter != digests_.end()) {
+    return iter->second;
+  }
+  string& digest = digests_[type];
   if (key_ == nullptr) {
-    return string();
+    return digest;
   }
   unsigned char* hash_buf = nullptr;
   size_t hash_len = 0;
   int result = ssh_get_publickey_hash(key_, type, &hash_buf, &hash_len);
   if (result != 0) {
-    return string();
+    return digest;
   }
-  unique_ptr<char[]> hash_hex(ssh_get_hexa(hash_buf, hash_len));
-  string hash(hash_hex.get());
+  digest.assign(reinterpret_cast<const char*>(hash_buf), hash_len);
   ssh_clean_pubkey_hash(&hash_buf);
-  return hash;
+  return digest;
+}
+
+string Key::Hash(const ssh_publickey_hash_type type) const {
+  const string& digest = Digest(type);
+  if (digest.empty()) {
+    return string();
+  }
+  unique_ptr<char[]> hash_hex(ssh_get_hexa(
+      reinterpret_cast<const unsigned char*>(digest.data()), digest.size()));
+  return string(hash_hex.get());
 }
 
 KeyType Key::GetKeyType() const { return KeyType(ssh_key_type(key_)); }
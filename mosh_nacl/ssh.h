@@ -25,6 +25,7 @@
 
 #include <libssh/libssh.h>
 
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -147,6 +148,10 @@ class Session : public ResultCode {
   // ssh_disconnect().
   void Disconnect();
 
+  // Gets the socket of the connection, or -1 if not connected. Analog to
+  // ssh_get_fd().
+  int GetFd() { return ssh_get_fd(s_); }
+
   // Determines if the connected server is known. Analog to
   // ssh_is_server_known().
   bool ServerKnown() {
@@ -161,6 +166,11 @@ class Session : public ResultCode {
   // is stubborn, the list will be empty. Check GetLastError().
   ::std::vector<AuthenticationType> GetAuthenticationTypes();
 
+  // Get the list of authentication types the server said can continue when it
+  // last denied or partially accepted one. Unlike GetAuthenticationTypes(),
+  // does not ask the server again.
+  ::std::vector<AuthenticationType> GetRemainingAuthenticationTypes();
+
   // Authenticate using password auth. Analog to ssh_userauth_password().
   //
   // Using a plain char * to allow you to manage the lifecycle of sensitive
@@ -287,6 +297,11 @@ class Key {
   // Get key as SHA256 hash. Will return an empty string on error.
   std::string SHA256() const;
 
+  // Get the raw bytes of the key's hash of |type|, rather than hex. Will
+  // return an empty string on error. Each hash is computed once, and the
+  // reference stays valid until another key is imported.
+  const std::string& Digest(ssh_publickey_hash_type type) const;
+
   // Get the key type of this key.
   KeyType GetKeyType() const;
 
@@ -294,6 +309,8 @@ class Key {
   std::string Hash(ssh_publickey_hash_type type) const;
 
   ssh_key key_ = nullptr;
+  // Digests computed so far, by type.
+  mutable std::map<ssh_publickey_hash_type, std::string> digests_;
 };
 
 // Represents an ssh channel.
@@ -17,7 +17,9 @@
 
 #include "mosh_nacl/ssh_login.h"
 
+#include <arpa/inet.h>
 #include <string.h>  // TODO(rpwoodbu): Eliminate use of strlen().
+#include <sys/socket.h>
 #include <algorithm>
 #include <functional>
 #include <future>  // NOLINT(build/c++11)
@@ -42,6 +44,9 @@ const int INPUT_SIZE = 256;
 const int RETRIES = 3;
 const string kServerCommandDefault(
     "mosh-server new -s -c 256 -l LANG=en_US.UTF-8");
+// Prefix of the names under which authentication methods are kept in known
+// hosts.
+const string kAuthMethodsPrefix("auth ");
 
 namespace {
 
@@ -74,6 +79,28 @@ void GetKeyboardLine(char* buf, size_t len, bool echo) {
   buf[i] = 0;
 }
 
+// Returns the address of the peer of the socket |fd|, or the empty string on
+// failure.
+string PeerAddress(int fd) {
+  struct sockaddr_storage peer;
+  socklen_t peer_len = sizeof(peer);
+  if (getpeername(fd, reinterpret_cast<struct sockaddr*>(&peer), &peer_len) !=
+      0) {
+    return "";
+  }
+  char buf[INET6_ADDRSTRLEN] = "";
+  const void* addr;
+  if (peer.ss_family == AF_INET6) {
+    addr = &reinterpret_cast<struct sockaddr_in6*>(&peer)->sin6_addr;
+  } else {
+    addr = &reinterpret_cast<struct sockaddr_in*>(&peer)->sin_addr;
+  }
+  if (inet_ntop(peer.ss_family, addr, buf, sizeof(buf)) == nullptr) {
+    return "";
+  }
+  return buf;
+}
+
 }  // anonymous namespace
 
 bool SSHLogin::AskYesNo(const string& prompt) {
@@ -102,8 +129,9 @@ bool SSHLogin::Start() {
     return false;
   }
 
-  session_ =
-      make_unique<ssh::Session>(resolved_addr_, atoi(port_.c_str()), user_);
+  // libssh resolves the name again via getaddrinfo(), which the resolver's
+  // cache answers in the family the user chose, and can try each address.
+  session_ = make_unique<ssh::Session>(host_, atoi(port_.c_str()), user_);
   // Extend connection timeout to 30s.
   session_->SetOption(SSH_OPTIONS_TIMEOUT, 30);
   // Uncomment below for lots of debugging output.
@@ -115,6 +143,14 @@ bool SSHLogin::Start() {
     return false;
   }
 
+  // Use the address libssh actually connected to.
+  resolved_addr_ = PeerAddress(session_->GetFd());
+  if (resolved_addr_.empty()) {
+    fprintf(stderr, "Could not determine the address of %s.\r\n",
+            host_.c_str());
+    return false;
+  }
+
   if (!CheckFingerprint()) {
     return false;
   }
@@ -124,23 +160,25 @@ bool SSHLogin::Start() {
     return false;
   }
 
-  bool authenticated = false;
-  for (const auto& auth : *auths_ptr) {
+  AuthPlanner planner(*auths_ptr, AuthPlanner::Decode(remembered_auths_));
+  ssh::AuthenticationType auth;
+  while (planner.Next(&auth)) {
     printf("Trying authentication type %s\r\n",
            ssh::GetAuthenticationTypeName(auth).c_str());
 
+    AuthPlanner::Result result = AuthPlanner::Result::FAILED;
     switch (auth) {
       case ssh::AuthenticationType::kPassword:
-        authenticated = DoPasswordAuth();
+        result = DoPasswordAuth();
         break;
       case ssh::AuthenticationType::kInteractive:
-        authenticated = DoInteractiveAuth();
+        result = DoInteractiveAuth();
         break;
       case ssh::AuthenticationType::kPublicKey:
-        authenticated = DoPublicKeyAuth();
+        result = DoPublicKeyAuth();
         break;
       case ssh::AuthenticationType::kNone:
-        authenticated = true;
+        result = AuthPlanner::Result::AUTHENTICATED;
         break;
       case ssh::AuthenticationType::kHostBased:
         // Not supported.
@@ -148,20 +186,29 @@ bool SSHLogin::Start() {
     }
     // No default; compiler will complain about missing enum.
 
-    if (authenticated) {
-      break;
+    if (result == AuthPlanner::Result::PARTIAL) {
+      printf("Partially authenticated; more is required.\r\n");
     }
+    // The server names what it will still accept in its reply to a failed or
+    // partial attempt, so there's no need to try the rest.
+    planner.Report(result, session_->GetRemainingAuthenticationTypes());
   }
 
   // For safety, clear the sensitive data.
   key_.clear();
 
-  if (authenticated == false) {
+  if (planner.authenticated() == false) {
     fprintf(stderr, "ssh authentication failed: %s\r\n",
             session_->GetLastError().c_str());
     return false;
   }
 
+  // Remember what worked, to try it first next time.
+  const string auths = AuthPlanner::Encode(planner.succeeded());
+  if (auths != remembered_auths_) {
+    known_hosts_changes_.Set(kAuthMethodsPrefix + ServerName(), auths);
+  }
+
   if (!DoConversation()) {
     return false;
   }
@@ -170,8 +217,11 @@ bool SSHLogin::Start() {
 }
 
 bool SSHLogin::Resolve() {
-  // Lookup the address.
-  promise<string> addr_promise;
+  // Look up the address, to report on it early and to warm the resolver's
+  // cache. This stays separate from libssh's getaddrinfo(), which can't
+  // report whether the answer was DNSSEC-authenticated, and it runs alongside
+  // the SSHFP lookup. The address used is whatever libssh picks.
+  promise<bool> addr_promise;
   promise<Resolver::Authenticity> addr_auth_promise;
   resolver_->Resolve(host_, type_, [&addr_promise, &addr_auth_promise](
                                        Resolver::Error error,
@@ -182,18 +232,17 @@ bool SSHLogin::Resolve() {
       fprintf(stderr,
               "Could not resolve the hostname. "
               "Check the spelling and the address family.\r\n");
-      addr_promise.set_value("");
+      addr_promise.set_value(false);
       return;
     }
     if (error != Resolver::Error::OK) {
       fprintf(stderr,
               "Name resolution failed with unexpected error code: %d\r\n",
               error);
-      addr_promise.set_value("");
+      addr_promise.set_value(false);
       return;
     }
-    // Only using first address.
-    addr_promise.set_value(move(results[0]));
+    addr_promise.set_value(!results.empty());
   });
 
   // Simultaneously lookup the SSHFP record.
@@ -214,7 +263,7 @@ bool SSHLogin::Resolve() {
       });
 
   // Collect the results.
-  resolved_addr_ = addr_promise.get_future().get();
+  const bool resolved = addr_promise.get_future().get();
   resolved_fingerprints_ = fp_promise.get_future().get();
 
   switch (addr_auth_promise.get_future().get()) {
@@ -226,7 +275,7 @@ bool SSHLogin::Resolve() {
       break;
   }
 
-  if (resolved_addr_.size() == 0) {
+  if (!resolved) {
     return false;
   }
 
@@ -246,13 +295,15 @@ bool SSHLogin::Resolve() {
   return true;
 }
 
-bool SSHLogin::CheckFingerprint() {
-  string server_name;
+string SSHLogin::ServerName() const {
   if (host_.find(':') == string::npos) {
-    server_name = host_ + ":" + port_;
-  } else {
-    server_name = "[" + host_ + "]:" + port_;
+    return host_ + ":" + port_;
   }
+  return "[" + host_ + "]:" + port_;
+}
+
+bool SSHLogin::CheckFingerprint() {
+  const string server_name = ServerName();
   printf("Remote ssh host name/address:\r\n  %s\r\n", server_name.c_str());
 
   // TODO(rpwoodbu): Remove |legacy_server_name| and all the legacy fingerprint
@@ -268,6 +319,19 @@ bool SSHLogin::CheckFingerprint() {
 
   const ssh::Key& host_key = session_->GetPublicKey();
 
+  // Look up everything known about the host in one go, even if SSHFP will make
+  // the fingerprints moot, as the authentication methods are needed later.
+  const string auth_name = kAuthMethodsPrefix + server_name;
+  pp::VarDictionary known_hosts;
+  if (known_hosts_lookup_ != nullptr) {
+    known_hosts =
+        known_hosts_lookup_({server_name, legacy_server_name, auth_name});
+  }
+  const pp::Var remembered_auths_var = known_hosts.Get(auth_name);
+  if (remembered_auths_var.is_string()) {
+    remembered_auths_ = remembered_auths_var.AsString();
+  }
+
   // First check key against SSHFP record(s) (if any).
   if (!resolved_fingerprints_.empty()) {
     SSHFPRecordSet sshfp;
@@ -317,11 +381,11 @@ bool SSHLogin::CheckFingerprint() {
   const string server_fp = host_key.MD5();
   printf("%s key fingerprint of remote ssh host (MD5):\r\n  %s\r\n",
          host_key.GetKeyType().AsString().c_str(), server_fp.c_str());
-  const pp::Var stored_fp_var = known_hosts_.Get(server_name);
+  const pp::Var stored_fp_var = known_hosts.Get(server_name);
   if (stored_fp_var.is_undefined()) {
     // No stored fingerprint.
     // Check to see if there's a "legacy" entry (by IP address).
-    const pp::Var legacy_stored_fp_var = known_hosts_.Get(legacy_server_name);
+    const pp::Var legacy_stored_fp_var = known_hosts.Get(legacy_server_name);
     if (!legacy_stored_fp_var.is_undefined()) {
       const string legacy_stored_fp = legacy_stored_fp_var.AsString();
       if (legacy_stored_fp == server_fp) {
@@ -332,7 +396,7 @@ bool SSHLogin::CheckFingerprint() {
         bool result =
             AskYesNo("Would you like to use this fingerprint for this host?");
         if (result == true) {
-          known_hosts_.Set(server_name, legacy_stored_fp.c_str());
+          known_hosts_changes_.Set(server_name, legacy_stored_fp.c_str());
           return true;
         }
       }
@@ -340,7 +404,7 @@ bool SSHLogin::CheckFingerprint() {
 
     bool result = AskYesNo("Server fingerprint unknown. Store and continue?");
     if (result == true) {
-      known_hosts_.Set(server_name, server_fp);
+      known_hosts_changes_.Set(server_name, server_fp);
       return true;
     }
   } else {
@@ -357,7 +421,7 @@ bool SSHLogin::CheckFingerprint() {
     if (result == true) {
       result = AskYesNo("Don't take this lightly. Are you really sure?");
       if (result == true) {
-        known_hosts_.Set(server_name, server_fp);
+        known_hosts_changes_.Set(server_name, server_fp);
         return true;
       }
     }
@@ -407,7 +471,7 @@ unique_ptr<vector<ssh::AuthenticationType>> SSHLogin::GetAuthTypes() {
   return supported_auths;
 }
 
-bool SSHLogin::DoPasswordAuth() {
+AuthPlanner::Result SSHLogin::DoPasswordAuth() {
   for (int tries = RETRIES; tries > 0; --tries) {
     char input[INPUT_SIZE];
     printf("Password: ");
@@ -415,13 +479,16 @@ bool SSHLogin::DoPasswordAuth() {
     printf("\r\n");
     if (strlen(input) == 0) {
       // User provided no input; skip this authentication type.
-      return false;
+      return AuthPlanner::Result::FAILED;
     }
     bool authenticated = session_->AuthUsingPassword(input);
     // For safety, zero the sensitive input ASAP.
     memset(input, 0, sizeof(input));
     if (authenticated) {
-      return true;
+      return AuthPlanner::Result::AUTHENTICATED;
+    }
+    if (session_->GetLastErrorCode() == SSH_AUTH_PARTIAL) {
+      return AuthPlanner::Result::PARTIAL;
     }
     if (tries == 1) {
       // Only display error on last try.
@@ -429,7 +496,7 @@ bool SSHLogin::DoPasswordAuth() {
               session_->GetLastError().c_str());
     }
   }
-  return false;
+  return AuthPlanner::Result::FAILED;
 }
 
 // Formats a string for output. Particularly, adds '\r' after '\n'.
@@ -444,7 +511,7 @@ string FormatForOutput(const string& in) {
   return out;
 }
 
-bool SSHLogin::DoInteractiveAuth() {
+AuthPlanner::Result SSHLogin::DoInteractiveAuth() {
   ssh::KeyboardInteractive& kbd = session_->AuthUsingKeyboardInteractive();
 
   bool displayed_instruction = false;
@@ -479,11 +546,9 @@ bool SSHLogin::DoInteractiveAuth() {
     const char* error = nullptr;
     switch (status) {
       case ssh::KeyboardInteractive::kAuthenticated:
-        return true;
+        return AuthPlanner::Result::AUTHENTICATED;
       case ssh::KeyboardInteractive::kPartialAuthentication:
-        error = "Keyboard interactive succeeded but insufficient.";
-        tries = 0;
-        break;
+        return AuthPlanner::Result::PARTIAL;
       case ssh::KeyboardInteractive::kFailed:  // fallthrough
       default:
         error = "Keyboard interactive auth failed.";
@@ -494,19 +559,24 @@ bool SSHLogin::DoInteractiveAuth() {
       fprintf(stderr, "%s\r\n", error);
     }
   }
-  return false;
+  return AuthPlanner::Result::FAILED;
 }
 
-bool SSHLogin::DoPublicKeyAuth() {
+AuthPlanner::Result SSHLogin::DoPublicKeyAuth() {
   // First try to authenticate with an SSH agent, if desired.
-  if (use_agent_ && session_->AuthUsingAgent()) {
-    return true;
+  if (use_agent_) {
+    if (session_->AuthUsingAgent()) {
+      return AuthPlanner::Result::AUTHENTICATED;
+    }
+    if (session_->GetLastErrorCode() == SSH_AUTH_PARTIAL) {
+      return AuthPlanner::Result::PARTIAL;
+    }
   }
 
   for (int tries = RETRIES; tries > 0; --tries) {
     if (key_.size() == 0) {
       printf("No ssh key found.\r\n");
-      return false;
+      return AuthPlanner::Result::FAILED;
     }
     // First see if key loads with no passphrase.
     ssh::Key key;
@@ -517,7 +587,7 @@ bool SSHLogin::DoPublicKeyAuth() {
       printf("\r\n");
       if (strlen(input) == 0) {
         // User provided no input; skip this authentication type.
-        return false;
+        return AuthPlanner::Result::FAILED;
       }
       bool result = key.ImportPrivateKey(key_, input);
       memset(input, 0, sizeof(input));
@@ -534,14 +604,17 @@ bool SSHLogin::DoPublicKeyAuth() {
       }
     }
     if (session_->AuthUsingKey(key) == false) {
+      if (session_->GetLastErrorCode() == SSH_AUTH_PARTIAL) {
+        return AuthPlanner::Result::PARTIAL;
+      }
       fprintf(stderr, "Key auth failed: %s\r\n",
               session_->GetLastError().c_str());
-      return false;
+      return AuthPlanner::Result::FAILED;
     }
     // If we got here, auth succeeded.
-    return true;
+    return AuthPlanner::Result::AUTHENTICATED;
   }
-  return false;
+  return AuthPlanner::Result::FAILED;
 }
 
 bool SSHLogin::DoConversation() {
@@ -21,10 +21,12 @@
 #include "mosh_nacl/ssh.h"
 
 #include <stddef.h>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "mosh_nacl/auth_planner.h"
 #include "mosh_nacl/resolver.h"
 #include "ppapi/cpp/var.h"
 #include "ppapi/cpp/var_dictionary.h"
@@ -82,8 +84,21 @@ class SSHLogin {
     server_command_ = command;
   }
 
-  pp::VarDictionary known_hosts() const { return known_hosts_; }
-  void set_known_hosts(const pp::Var& var) { known_hosts_ = var; }
+  // Looks up the stored fingerprints of the named hosts, returning those that
+  // exist. Called from Start(), which may block on it. Also used for the
+  // authentication methods last used with a host, which are kept in known
+  // hosts under "auth " and the host's name.
+  typedef std::function<pp::VarDictionary(const std::vector<std::string>&)>
+      KnownHostsLookup;
+  void set_known_hosts_lookup(KnownHostsLookup lookup) {
+    known_hosts_lookup_ = lookup;
+  }
+
+  // Fingerprints and authentication methods stored or replaced during Start(),
+  // to be saved.
+  pp::VarDictionary known_hosts_changes() const {
+    return known_hosts_changes_;
+  }
 
   std::string mosh_port() const { return mosh_port_; }
 
@@ -92,10 +107,13 @@ class SSHLogin {
   std::string mosh_addr() const { return mosh_addr_; }
 
  private:
-  // Resolve |host_| and |type_| to |resolved_addr_| and |resolved_fp_| via
-  // |resolver_|.
+  // Resolve |host_|'s SSHFP records to |resolved_fingerprints_| via
+  // |resolver_|, and check that |host_| resolves as |type_|.
   bool Resolve();
 
+  // The name of the server in known hosts: |host_| and |port_|.
+  std::string ServerName() const;
+
   // Display and check the remote server fingerprint.
   bool CheckFingerprint();
 
@@ -107,9 +125,9 @@ class SSHLogin {
   // Prefers to return false if input is not parseable.
   bool AskYesNo(const std::string& prompt);
 
-  bool DoPasswordAuth();
-  bool DoInteractiveAuth();
-  bool DoPublicKeyAuth();
+  AuthPlanner::Result DoPasswordAuth();
+  AuthPlanner::Result DoInteractiveAuth();
+  AuthPlanner::Result DoPublicKeyAuth();
   bool DoConversation();
 
   bool use_agent_ = false;
@@ -123,15 +141,19 @@ class SSHLogin {
   std::string server_command_;
   std::string remote_command_;
 
-  // Resolved address of |host_|.
+  // Address of |host_| that the ssh session connected to.
   std::string resolved_addr_;
   // Resolved fingerprints for |host_|. Empty if none.
   std::vector<std::string> resolved_fingerprints_;
+  // Authentication methods that logged into |host_| last time, as stored in
+  // known hosts. Empty if none.
+  std::string remembered_auths_;
 
   std::string mosh_port_;
   std::string mosh_key_;
   std::string mosh_addr_;
-  pp::VarDictionary known_hosts_;
+  KnownHostsLookup known_hosts_lookup_;
+  pp::VarDictionary known_hosts_changes_;
   std::unique_ptr<ssh::Session> session_;
 };
 
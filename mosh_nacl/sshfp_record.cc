@@ -17,16 +17,15 @@
 
 #include "mosh_nacl/sshfp_record.h"
 
-#include <cstdio>
-#include <cstdlib>
-#include <functional>
+#include <string.h>
+
+#include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "mosh_nacl/ssh.h"
 
-using std::move;
 using std::string;
 using std::vector;
 
@@ -56,132 +55,126 @@ SSHFPRecordSet::Fingerprint::Algorithm ConvertAlgorithm(
   }
 }
 
-string ParseHex(const string& hex) {
-  string parsed;
-  string hex_byte;
-  for (const char hex_nibble : hex) {
-    if (hex_nibble == ':' || hex_nibble == ' ') {
-      // Skip over whitespace and delimiters.
-      continue;
-    }
-    if (hex_byte.empty()) {
-      hex_byte = hex_nibble;
-      continue;
-    }
-    hex_byte += hex_nibble;
-    parsed += strtol(hex_byte.c_str(), nullptr, 16);
-    hex_byte.clear();
-  }
-  return parsed;
-}
+// The most fingerprints a set can hold: one for each algorithm and type.
+const size_t kMaxFingerprints = 6 * 4;
 
-struct RdataParseResult {
-  bool parsed_ok = false;
-  int algorithm_num = -1;
-  int type_num = -1;
-  string fingerprint;
-};
+// Prefix of the "generic" RDATA form.
+const char kGenericPrefix[] = "\\# ";
 
-// Parse the "generic" RDATA form, which gives the wireform of the RDATA.
-// This looks like:
-//
-//   \# ss xxxxxxxx...
-//
-// ... where "ss" is the size of the data in decimal, and "xx" is the data in
-// hex.
-RdataParseResult ParseGeneric(const string& rdata) {
-  RdataParseResult result;
-
-  if (rdata.find("\\# ") != 0) {
-    // RDATA does not have "generic data" prefix.
-    return result;
-  }
+bool IsSpace(const char c) { return c == ' ' || c == '\t'; }
 
-  // Find whitespace after the prefix. We don't care about the size field; it
-  // is implied by the amount of data in the data field.
-  const size_t whitespace = rdata.find_first_of(" \t", 3);
-  if (whitespace == string::npos) {
-    return result;
-  }
-  const string data = ParseHex(rdata.substr(whitespace + 1));
-  if (data.size() < 3) {
-    // There must be at least 3 bytes: one for the algorithm, one for the
-    // fingerprint type, and at least one for the fingerprint (although in
-    // practice that's a ridiculously small fingerprint, but that's not for the
-    // parser to determine).
-    return result;
+const char* SkipSpace(const char* pos, const char* end) {
+  while (pos < end && IsSpace(*pos)) {
+    ++pos;
   }
+  return pos;
+}
 
-  result.algorithm_num = data[0];
-  result.type_num = data[1];
-  result.fingerprint = data.substr(2);
-  result.parsed_ok = true;
-  return result;
+// Reads a decimal number at |*pos|, advancing past it. Returns false if there
+// are no digits. Numbers too big to be any known algorithm or type stop
+// growing; they're unknown either way.
+bool ParseNumber(const char** pos, const char* end, int* value) {
+  const char* start = *pos;
+  *value = 0;
+  for (; *pos < end && **pos >= '0' && **pos <= '9'; ++*pos) {
+    if (*value < 256) {
+      *value = *value * 10 + (**pos - '0');
+    }
+  }
+  return *pos != start;
 }
 
-// Parse the proper presentation form of the SSHFP RDATA. This looks like:
-//
-//   a b cccccccc...
-//
-// ... where "a" is the algorithm number, "b" is the fingerprint type, and "cc"
-// is the fingerprint in hex.
-RdataParseResult ParsePresentation(const string& rdata) {
-  RdataParseResult result;
-
-  const int scanned =
-      sscanf(rdata.c_str(), "%d %d", &result.algorithm_num, &result.type_num);
-  if (scanned != 2) {
-    return result;
+int HexDigit(const char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
   }
-  // Safely find the fingerprint part (using sscanf() for extracting into
-  // strings is unsafe).
-  const size_t first_whitespace = rdata.find_first_of(" \t");
-  if (first_whitespace == string::npos) {
-    return result;
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
   }
-  const size_t second_whitespace =
-      rdata.find_first_of(" \t", first_whitespace + 1);
-  if (second_whitespace == string::npos) {
-    return result;
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
   }
-  result.fingerprint = ParseHex(rdata.substr(second_whitespace + 1));
-  if (result.fingerprint.empty()) {
-    return result;
+  return -1;
+}
+
+// Reads a byte of hex at |*pos|, skipping whitespace and delimiters, and
+// advancing past it. Returns 1 if a byte was read, 0 at the end (ignoring any
+// odd nibble), and -1 on anything that isn't hex.
+int NextHexByte(const char** pos, const char* end, uint8_t* byte) {
+  int high = -1;
+  for (; *pos < end; ++*pos) {
+    if (**pos == ':' || IsSpace(**pos)) {
+      continue;
+    }
+    const int nibble = HexDigit(**pos);
+    if (nibble < 0) {
+      return -1;
+    }
+    if (high < 0) {
+      high = nibble;
+      continue;
+    }
+    *byte = high << 4 | nibble;
+    ++*pos;
+    return 1;
   }
+  return 0;
+}
 
-  result.parsed_ok = true;
-  return result;
+// Finds where a fingerprint of |algorithm| and |type| is, or would go, in
+// the sorted range [|begin|, |end|).
+template <typename Iterator>
+Iterator LowerBound(Iterator begin, Iterator end,
+                    const SSHFPRecordSet::Fingerprint::Algorithm algorithm,
+                    const SSHFPRecordSet::Fingerprint::Type type) {
+  return std::lower_bound(
+      begin, end, std::make_pair(algorithm, type),
+      [](const SSHFPRecordSet::Fingerprint& fingerprint,
+         const std::pair<SSHFPRecordSet::Fingerprint::Algorithm,
+                         SSHFPRecordSet::Fingerprint::Type>& key) {
+        return std::make_pair(fingerprint.algorithm(), fingerprint.type()) <
+               key;
+      });
 }
 
 }  // anonymous namespace
 
+const size_t SSHFPRecordSet::Fingerprint::kMaxSize;
+
 bool SSHFPRecordSet::Parse(const vector<string>& rdata) {
   fingerprints_.clear();
+  fingerprints_.reserve(kMaxFingerprints);
   for (const auto& r : rdata) {
     Fingerprint fingerprint;
     if (!fingerprint.Parse(r)) {
       return false;
     }
-    fingerprints_[fingerprint.algorithm()].emplace(fingerprint.type(),
-                                                   move(fingerprint));
+    // Keep the set sorted as it's built. It's tiny, and any repeat of an
+    // algorithm and type is dropped, as the first one wins.
+    const auto iter =
+        LowerBound(fingerprints_.begin(), fingerprints_.end(),
+                   fingerprint.algorithm(), fingerprint.type());
+    if (iter == fingerprints_.end() ||
+        iter->algorithm() != fingerprint.algorithm() ||
+        iter->type() != fingerprint.type()) {
+      fingerprints_.insert(iter, fingerprint);
+    }
   }
   return true;
 }
 
 SSHFPRecordSet::Validity SSHFPRecordSet::IsValid(const ssh::Key& key) const {
   const auto key_algorithm = ConvertAlgorithm(key.GetKeyType().type());
-  if (fingerprints_.count(key_algorithm) == 0) {
-    // No SSHFP record for this key's algorithm.
-    return Validity::INSUFFICIENT;
-  }
-  const auto& fingerprints_by_type = fingerprints_.at(key_algorithm);
   for (const auto& type : kFingerprintPriority) {
-    const auto& fingerprint_iter = fingerprints_by_type.find(type);
-    if (fingerprint_iter == fingerprints_by_type.end()) {
+    const auto fingerprint_iter = LowerBound(
+        fingerprints_.begin(), fingerprints_.end(), key_algorithm, type);
+    if (fingerprint_iter == fingerprints_.end() ||
+        fingerprint_iter->algorithm() != key_algorithm ||
+        fingerprint_iter->type() != type) {
       // That fingerprint type doesn't exist. Try the next one in the list.
       continue;
     }
-    const auto& fingerprint = fingerprint_iter->second;
+    const auto& fingerprint = *fingerprint_iter;
     switch (fingerprint.IsValid(key)) {
       case Validity::VALID:
         // Accept the first valid fingerprint.
@@ -202,18 +195,85 @@ SSHFPRecordSet::Validity SSHFPRecordSet::IsValid(const ssh::Key& key) const {
   return Validity::INSUFFICIENT;
 }
 
-bool SSHFPRecordSet::Fingerprint::Parse(const string& rdata) {
-  RdataParseResult parsed;
+string SSHFPRecordSet::Fingerprint::fingerprint() const {
+  return string(reinterpret_cast<const char*>(fingerprint_),
+                std::min<size_t>(size_, kMaxSize));
+}
 
-  parsed = ParseGeneric(rdata);
-  if (!parsed.parsed_ok) {
-    parsed = ParsePresentation(rdata);
+bool SSHFPRecordSet::Fingerprint::ParseHex(const char* pos, const char* end) {
+  size_t size = 0;
+  uint8_t byte;
+  int result;
+  while ((result = NextHexByte(&pos, end, &byte)) > 0) {
+    if (size < kMaxSize) {
+      fingerprint_[size] = byte;
+    }
+    ++size;
   }
-  if (!parsed.parsed_ok) {
+  size_ = std::min(size, kMaxSize + 1);
+  return result == 0;
+}
+
+bool SSHFPRecordSet::Fingerprint::Parse(const char* rdata, const size_t size) {
+  algorithm_ = Algorithm::UNSET;
+  type_ = Type::UNSET;
+  size_ = 0;
+
+  const char* pos = rdata;
+  const char* const end = rdata + size;
+  int algorithm_num = -1;
+  int type_num = -1;
+  const size_t prefix_size = sizeof(kGenericPrefix) - 1;
+  if (size >= prefix_size && memcmp(rdata, kGenericPrefix, prefix_size) == 0) {
+    // The "generic" form gives the wireform of the RDATA. This looks like:
+    //
+    //   \# ss xxxxxxxx...
+    //
+    // ... where "ss" is the size of the data in decimal, and "xx" is the data
+    // in hex: a byte for the algorithm, a byte for the fingerprint type, and
+    // the fingerprint. We don't care about the size field; it is implied by
+    // the amount of data in the data field.
+    pos += prefix_size;
+    while (pos < end && !IsSpace(*pos)) {
+      ++pos;
+    }
+    if (pos == end) {
+      return false;
+    }
+    uint8_t byte;
+    if (NextHexByte(&pos, end, &byte) <= 0) {
+      return false;
+    }
+    algorithm_num = byte;
+    if (NextHexByte(&pos, end, &byte) <= 0) {
+      return false;
+    }
+    type_num = byte;
+  } else {
+    // The proper presentation form looks like:
+    //
+    //   a b cccccccc...
+    //
+    // ... where "a" is the algorithm number, "b" is the fingerprint type, and
+    // "cc" is the fingerprint in hex.
+    pos = SkipSpace(pos, end);
+    if (!ParseNumber(&pos, end, &algorithm_num) || pos == end ||
+        !IsSpace(*pos)) {
+      return false;
+    }
+    pos = SkipSpace(pos, end);
+    if (!ParseNumber(&pos, end, &type_num) || pos == end || !IsSpace(*pos)) {
+      return false;
+    }
+  }
+  // There must be at least one byte of fingerprint (although in practice
+  // that's a ridiculously small fingerprint, but that's not for the parser to
+  // determine).
+  if (!ParseHex(pos, end) || size_ == 0) {
     return false;
   }
 
-  switch (parsed.algorithm_num) {
+  switch (algorithm_num) {
     case 1:
       algorithm_ = Algorithm::RSA;
       break;
@@ -231,7 +291,7 @@ bool SSHFPRecordSet::Fingerprint::Parse(const string& rdata) {
       break;
   }
 
-  switch (parsed.type_num) {
+  switch (type_num) {
     case 0:
       type_ = Type::RESERVED;
       break;
@@ -246,8 +306,6 @@ bool SSHFPRecordSet::Fingerprint::Parse(const string& rdata) {
       break;
   }
 
-  fingerprint_ = move(parsed.fingerprint);
-
   return true;
 }
 
@@ -266,18 +324,22 @@ SSHFPRecordSet::Validity SSHFPRecordSet::Fingerprint::IsValid(
     return Validity::INSUFFICIENT;
   }
 
-  bool is_valid = false;
+  ssh_publickey_hash_type hash_type;
   switch (type_) {
     case Type::SHA1:
-      is_valid = ParseHex(key.SHA1()) == fingerprint_;
+      hash_type = SSH_PUBLICKEY_HASH_SHA1;
       break;
     case Type::SHA256:
-      is_valid = ParseHex(key.SHA256()) == fingerprint_;
+      hash_type = SSH_PUBLICKEY_HASH_SHA256;
       break;
     default:
       // No support for the requested type.
       return Validity::INSUFFICIENT;
   }
 
+  // A fingerprint too long to keep can't match.
+  const string& digest = key.Digest(hash_type);
+  const bool is_valid = digest.size() == size_ &&
+                        memcmp(digest.data(), fingerprint_, size_) == 0;
   return is_valid ? Validity::VALID : Validity::INVALID;
 }
@@ -18,7 +18,9 @@
 #ifndef MOSH_NACL_SSHFP_RECORD_H_
 #define MOSH_NACL_SSHFP_RECORD_H_
 
-#include <map>
+#include <stddef.h>
+#include <stdint.h>
+
 #include <string>
 #include <vector>
 
@@ -79,13 +81,20 @@ class SSHFPRecordSet {
       SHA256,
     };
 
+    // The longest fingerprint kept; that of SHA256. Longer ones are parsed,
+    // but can only be used to invalidate a key.
+    static const size_t kMaxSize = 32;
+
     Algorithm algorithm() const { return algorithm_; }
     Type type() const { return type_; }
-    std::string fingerprint() const { return fingerprint_; }
+    std::string fingerprint() const;
 
     // Parses one SSHFP RDATA in either presentation format or "\#" generic
     // format. Returns false on parse error. Erases any previously parsed data.
-    bool Parse(const std::string& rdata);
+    bool Parse(const std::string& rdata) {
+      return Parse(rdata.data(), rdata.size());
+    }
+    bool Parse(const char* rdata, size_t size);
 
     // Checks to see if the algorithm of |key| matches the algorithm of the
     // fingerprint.
@@ -96,14 +105,21 @@ class SSHFPRecordSet {
     Validity IsValid(const ssh::Key& key) const;
 
    private:
+    // Parses hex from |data| into fingerprint_, skipping delimiters. Returns
+    // false on anything else.
+    bool ParseHex(const char* data, const char* end);
+
     Algorithm algorithm_ = Algorithm::UNSET;
     Type type_ = Type::UNSET;
-    std::string fingerprint_;
+    // Size of the fingerprint, or kMaxSize + 1 if it was longer than that.
+    uint8_t size_ = 0;
+    uint8_t fingerprint_[kMaxSize];
   };
 
  private:
-  std::map<Fingerprint::Algorithm, std::map<Fingerprint::Type, Fingerprint>>
-      fingerprints_;
+  // Fingerprints sorted by algorithm and type, with only the first of any
+  // duplicates kept, so that a lookup is a binary search of one flat array.
+  std::vector<Fingerprint> fingerprints_;
 };
 
 #endif  // MOSH_NACL_SSHFP_RECORD_H_
@@ -18,7 +18,9 @@
 #include "mosh_nacl/sshfp_record.h"
 
 #include <assert.h>
+#include <stdio.h>
 
+#include <chrono>  // NOLINT(build/c++11)
 #include <string>
 #include <vector>
 
@@ -223,3 +225,96 @@ TEST_F(SSHFPRecordSetTest, UnknownAndGoodSHA1Fingerprints) {
   EXPECT_EQ(SSHFPRecordSet::Validity::VALID, sshfp.IsValid(dsa_key_));
   EXPECT_EQ(SSHFPRecordSet::Validity::VALID, sshfp.IsValid(ecdsa_key_));
 }
+
+// A fingerprint longer than any supported hash can't validate anything, even
+// if it starts with the right one.
+TEST_F(SSHFPRecordSetTest, OverlongFingerprint) {
+  const vector<string> sshfp_rrset = {
+      "1 2 10AC3932B45D3C20D2E2B47708E200B0420D3C17E3937B480AAE4173 CD94B79B00",
+  };
+
+  SSHFPRecordSet sshfp;
+  ASSERT_TRUE(sshfp.Parse(sshfp_rrset));
+  EXPECT_EQ(SSHFPRecordSet::Validity::INVALID, sshfp.IsValid(rsa_key_));
+}
+
+TEST_F(SSHFPRecordSetTest, MalformedRecords) {
+  SSHFPRecordSet sshfp;
+  EXPECT_FALSE(sshfp.Parse({"1 1"}));
+  EXPECT_FALSE(sshfp.Parse({"1 1 "}));
+  EXPECT_FALSE(sshfp.Parse({"one 1 1B9F53A938596DF02086CC972850D50B7C65F645"}));
+  EXPECT_FALSE(sshfp.Parse({"1 1 1B9F53A938596DF02086CC972850D50B7C65F64G"}));
+  EXPECT_FALSE(sshfp.Parse({"\\# 22"}));
+  EXPECT_FALSE(sshfp.Parse({"\\# 2 0101"}));
+}
+
+// Times parsing and validation against a large RRset, most of it of
+// algorithms we don't know. Not run by default; see sshfp_record_benchmark.
+TEST_F(SSHFPRecordSetTest, DISABLED_BenchmarkLargeRRset) {
+  const int kUnknownRecords = 1000;
+  const int kIterations = 1000;
+  vector<string> sshfp_rrset = {
+      "1 1 1B9F53A938596DF02086CC972850D50B7C65F645",
+      "1 2 10AC3932B45D3C20D2E2B47708E200B0420D3C17E3937B480AAE4173 CD94B79B",
+  };
+  for (int i = 0; i < kUnknownRecords; ++i) {
+    char rdata[100];
+    snprintf(rdata, sizeof(rdata),
+             "%d 2 %08X6BB1A707DCB4A773FD0DE292FF664271B51A25959C59552B4"
+             "73C09153",
+             5 + i % 245, i);
+    sshfp_rrset.push_back(rdata);
+  }
+
+  typedef std::chrono::steady_clock Clock;
+  SSHFPRecordSet sshfp;
+  auto start = Clock::now();
+  for (int i = 0; i < kIterations; ++i) {
+    ASSERT_TRUE(sshfp.Parse(sshfp_rrset));
+  }
+  const double parse_us =
+      std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+  start = Clock::now();
+  for (int i = 0; i < kIterations; ++i) {
+    ASSERT_EQ(SSHFPRecordSet::Validity::VALID, sshfp.IsValid(rsa_key_));
+  }
+  const double validate_us =
+      std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+  printf("%zu records: Parse() %.1f us, IsValid() %.3f us\n",
+         sshfp_rrset.size(), parse_us / kIterations,
+         validate_us / kIterations);
+}
+
+// As above, with the records in generic form.
+TEST_F(SSHFPRecordSetTest, DISABLED_BenchmarkLargeGenericRRset) {
+  const int kUnknownRecords = 1000;
+  const int kIterations = 1000;
+  vector<string> sshfp_rrset = {
+      "\\# 22 01011B9F53A938596DF02086CC972850D50B7C65F645",
+      "\\# 34 020210AC3932B45D3C20D2E2B47708E200B0420D3C17E3937B480AAE4173"
+      "CD94B79B",
+  };
+  for (int i = 0; i < kUnknownRecords; ++i) {
+    char rdata[100];
+    snprintf(rdata, sizeof(rdata),
+             "\\# 34 %02X02%08X6BB1A707DCB4A773FD0DE292FF664271B51A25959C5955"
+             "2B473C09153",
+             5 + i % 245, i);
+    sshfp_rrset.push_back(rdata);
+  }
+
+  typedef std::chrono::steady_clock Clock;
+  SSHFPRecordSet sshfp;
+  const auto start = Clock::now();
+  for (int i = 0; i < kIterations; ++i) {
+    ASSERT_TRUE(sshfp.Parse(sshfp_rrset));
+  }
+  const double parse_us =
+      std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+  EXPECT_EQ(SSHFPRecordSet::Validity::VALID, sshfp.IsValid(rsa_key_));
+
+  printf("%zu generic records: Parse() %.1f us\n", sshfp_rrset.size(),
+         parse_us / kIterations);
+}
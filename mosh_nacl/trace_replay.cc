@@ -0,0 +1,201 @@
+// trace_replay.cc - Replays a POSIX I/O trace for benchmarking.
+//
+// Usage: trace_replay [--realtime] TRACE
+//
+// Reads a trace made by PepperPOSIX::IOTrace and summarizes it. Then it
+// replays the inbound events through an EventQueue and Selector, as POSIX
+// receives them, and the display output through a UTF8Splitter, as the
+// Terminal sends it, and reports how long each took. Events are replayed as
+// fast as possible, or with their recorded timing if --realtime is given.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>  // NOLINT(build/c++11)
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "mosh_nacl/pepper_posix_event_queue.h"
+#include "mosh_nacl/pepper_posix_selector.h"
+#include "mosh_nacl/pepper_posix_trace.h"
+#include "mosh_nacl/utf8_splitter.h"
+
+using PepperPOSIX::Event;
+using PepperPOSIX::EventQueue;
+using PepperPOSIX::IOTrace;
+using PepperPOSIX::Selector;
+using PepperPOSIX::Target;
+using PepperPOSIX::TraceRecord;
+using std::string;
+using std::vector;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void Summarize(const vector<TraceRecord>& records) {
+  static const char* const kKindNames[] = {"receive", "end", "error", "send",
+                                           "window change"};
+  uint64_t counts[TraceRecord::NUM_KINDS] = {};
+  uint64_t bytes[TraceRecord::NUM_KINDS] = {};
+  for (const auto& record : records) {
+    ++counts[record.kind];
+    bytes[record.kind] += record.data.size();
+  }
+  const double duration =
+      records.empty() ? 0 : (records.back().time - records.front().time) / 1e6;
+  printf("%zu records over %.3f s\n", records.size(), duration);
+  for (int kind = 0; kind < TraceRecord::NUM_KINDS; ++kind) {
+    printf("  %-14s %8llu records %12llu bytes\n", kKindNames[kind],
+           static_cast<unsigned long long>(counts[kind]),  // NOLINT
+           static_cast<unsigned long long>(bytes[kind]));  // NOLINT
+  }
+}
+
+// Pushes the inbound records through an EventQueue from another thread, as
+// Pepper callbacks do, while this thread selects and takes them, as POSIX does.
+void ReplayInbound(const vector<TraceRecord>& records, bool realtime) {
+  Selector selector;
+  EventQueue queue(selector, -1);
+  uint64_t expected = 0;
+  for (const auto& record : records) {
+    if (record.kind != TraceRecord::SEND &&
+        record.kind != TraceRecord::WINDOW_CHANGE) {
+      ++expected;
+    }
+  }
+  if (expected == 0) {
+    return;
+  }
+
+  const auto start = Clock::now();
+  std::thread producer([&records, &queue, realtime, start]() {
+    const int64_t first_time = records.front().time;
+    for (const auto& record : records) {
+      if (record.kind == TraceRecord::SEND ||
+          record.kind == TraceRecord::WINDOW_CHANGE) {
+        continue;
+      }
+      if (realtime) {
+        std::this_thread::sleep_until(
+            start + std::chrono::microseconds(record.time - first_time));
+      }
+      Event event;
+      event.fd = record.fd;
+      event.data = record.data;
+      event.eof = record.kind == TraceRecord::END;
+      event.error = record.kind == TraceRecord::ERROR ? record.value : 0;
+      queue.Push(std::move(event));
+    }
+  });
+
+  const vector<Target*> read_targets(1, queue.target());
+  const vector<Target*> no_targets;
+  const struct timespec timeout = {1, 0};
+  vector<Event> batch;
+  uint64_t received = 0;
+  while (received < expected) {
+    selector.Select(read_targets, no_targets, &timeout);
+    queue.Take(&batch);
+    received += batch.size();
+  }
+  producer.join();
+
+  const double elapsed = SecondsSince(start);
+  const auto& stats = queue.stats();
+  printf(
+      "Inbound: %llu events in %.3f s (%.0f/s), %llu batches; "
+      "queueing delay mean %.1f us, max %u us\n",
+      static_cast<unsigned long long>(stats.events),   // NOLINT(runtime/int)
+      elapsed, stats.events / elapsed,
+      static_cast<unsigned long long>(stats.batches),  // NOLINT(runtime/int)
+      stats.events == 0 ? 0.0
+                        : static_cast<double>(stats.total_delay_us) /
+                              stats.events,
+      stats.max_delay_us);
+}
+
+// Sends the display output through a UTF8Splitter, as Terminal::Write() does.
+void ReplayDisplay(const vector<TraceRecord>& records) {
+  UTF8Splitter splitter;
+  string out;
+  uint64_t writes = 0;
+  uint64_t bytes = 0;
+  const auto start = Clock::now();
+  for (const auto& record : records) {
+    if (record.kind == TraceRecord::SEND && record.fd == STDOUT_FILENO) {
+      out.clear();
+      splitter.Split(record.data.data(), record.data.size(), &out);
+      ++writes;
+      bytes += out.size();
+    }
+  }
+  const double elapsed = SecondsSince(start);
+  printf("Display: %llu writes, %llu bytes in %.6f s\n",
+         static_cast<unsigned long long>(writes),  // NOLINT(runtime/int)
+         static_cast<unsigned long long>(bytes),   // NOLINT(runtime/int)
+         elapsed);
+}
+
+}  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+  bool realtime = false;
+  const char* path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--realtime") == 0) {
+      realtime = true;
+    } else {
+      path = argv[i];
+    }
+  }
+  if (path == nullptr) {
+    fprintf(stderr, "Usage: %s [--realtime] TRACE\n", argv[0]);
+    return 2;
+  }
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    fprintf(stderr, "Could not open %s\n", path);
+    return 1;
+  }
+  std::stringstream trace;
+  trace << file.rdbuf();
+
+  vector<TraceRecord> records;
+  if (!IOTrace::Parse(trace.str(), &records)) {
+    if (records.empty()) {
+      fprintf(stderr, "%s is not a trace\n", path);
+      return 1;
+    }
+    fprintf(stderr, "%s is damaged; replaying the first %zu records\n", path,
+            records.size());
+  }
+
+  Summarize(records);
+  ReplayInbound(records, realtime);
+  ReplayDisplay(records);
+  return 0;
+}
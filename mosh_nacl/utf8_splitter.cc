@@ -0,0 +1,168 @@
+// utf8_splitter.cc - Splits a byte stream into whole UTF-8 messages.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/utf8_splitter.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+using std::string;
+
+namespace {
+
+// U+FFFD REPLACEMENT CHARACTER.
+const char kReplacement[] = "\xef\xbf\xbd";
+
+// High bit of every byte in a word; set in any non-ASCII byte.
+const uint64_t kHighBits = 0x8080808080808080ULL;
+
+// Classifies the sequence starting at |buf|. Returns its length if it is
+// valid, 0 if it is a valid but truncated prefix, or the negated length of
+// the maximal invalid subpart (per Unicode's "best practice" for U+FFFD
+// substitution) otherwise.
+int Classify(const unsigned char* buf, size_t count) {
+  const unsigned char lead = buf[0];
+  if (lead < 0x80) {
+    return 1;
+  }
+
+  size_t length;
+  unsigned char low = 0x80;
+  unsigned char high = 0xbf;
+  if (lead < 0xc2) {
+    // Continuation byte or overlong 2-byte lead.
+    return -1;
+  } else if (lead < 0xe0) {
+    length = 2;
+  } else if (lead < 0xf0) {
+    length = 3;
+    if (lead == 0xe0) {
+      low = 0xa0;  // Overlong.
+    } else if (lead == 0xed) {
+      high = 0x9f;  // Surrogates.
+    }
+  } else if (lead < 0xf5) {
+    length = 4;
+    if (lead == 0xf0) {
+      low = 0x90;  // Overlong.
+    } else if (lead == 0xf4) {
+      high = 0x8f;  // Beyond U+10FFFF.
+    }
+  } else {
+    return -1;
+  }
+
+  for (size_t i = 1; i < length; ++i) {
+    if (i >= count) {
+      return 0;
+    }
+    if (buf[i] < low || buf[i] > high) {
+      return -static_cast<int>(i);
+    }
+    // Only the second byte has a restricted range.
+    low = 0x80;
+    high = 0xbf;
+  }
+  return static_cast<int>(length);
+}
+
+}  // anonymous namespace
+
+void UTF8Splitter::Split(const void* buf, size_t count, string* out) {
+  const unsigned char* ubuf = static_cast<const unsigned char*>(buf);
+
+  // Complete (or reject) any sequence held back from the previous call.
+  while (pending_size_ > 0 && count > 0) {
+    pending_[pending_size_++] = *ubuf;
+    const int result = Classify(pending_, pending_size_);
+    if (result == 0) {
+      // Still incomplete; keep going.
+      ++ubuf;
+      --count;
+      continue;
+    }
+    if (result > 0) {
+      out->append(reinterpret_cast<const char*>(pending_), result);
+      ++ubuf;
+      --count;
+      pending_size_ = 0;
+      break;
+    }
+    // The held-back prefix is invalid given the new byte. The new byte was
+    // not part of it, so leave it in |buf| to be decoded normally.
+    out->append(kReplacement);
+    pending_size_ = 0;
+  }
+
+  const size_t consumed = Decode(ubuf, count, out);
+  const size_t remaining = count - consumed;
+  if (remaining > 0) {
+    memcpy(pending_, ubuf + consumed, remaining);
+    pending_size_ = remaining;
+  }
+}
+
+void UTF8Splitter::Flush(string* out) {
+  if (pending_size_ > 0) {
+    out->append(kReplacement);
+    pending_size_ = 0;
+  }
+}
+
+size_t UTF8Splitter::Decode(const unsigned char* buf, size_t count,
+                            string* out) {
+  out->reserve(out->size() + count);
+
+  // Valid bytes are appended in runs starting at |run|; only invalid input or
+  // the end of the buffer interrupts a run.
+  size_t run = 0;
+  size_t i = 0;
+  while (i < count) {
+    // Fast path: skip over ASCII eight bytes at a time.
+    while (i + sizeof(uint64_t) <= count) {
+      uint64_t word;
+      memcpy(&word, buf + i, sizeof(word));
+      if ((word & kHighBits) != 0) {
+        break;
+      }
+      i += sizeof(word);
+    }
+    while (i < count && buf[i] < 0x80) {
+      ++i;
+    }
+    if (i == count) {
+      break;
+    }
+
+    const int result = Classify(buf + i, count - i);
+    if (result > 0) {
+      i += result;
+      continue;
+    }
+    out->append(reinterpret_cast<const char*>(buf + run), i - run);
+    if (result == 0) {
+      // Truncated sequence at the end; leave it for the caller.
+      return i;
+    }
+    out->append(kReplacement);
+    i += -result;
+    run = i;
+  }
+  out->append(reinterpret_cast<const char*>(buf + run), i - run);
+  return i;
+}
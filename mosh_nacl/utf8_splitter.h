@@ -0,0 +1,60 @@
+// utf8_splitter.h - Splits a byte stream into whole UTF-8 messages.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MOSH_NACL_UTF8_SPLITTER_H_
+#define MOSH_NACL_UTF8_SPLITTER_H_
+
+#include <stddef.h>
+#include <string>
+
+// UTF8Splitter turns arbitrarily chunked output into strings that are always
+// valid UTF-8, suitable for sending to JavaScript as a pp::Var. A multibyte
+// sequence that is cut off at the end of one chunk is held back and completed
+// by the next one, so a codepoint is never split across messages. Invalid
+// bytes are replaced with U+FFFD. Runs of ASCII, which is the bulk of
+// terminal output, are scanned a word at a time and copied in one go.
+class UTF8Splitter {
+ public:
+  UTF8Splitter() = default;
+  UTF8Splitter(const UTF8Splitter&) = delete;
+  UTF8Splitter& operator=(const UTF8Splitter&) = delete;
+  ~UTF8Splitter() = default;
+
+  // Appends to |out| all complete UTF-8 from any held-back bytes followed by
+  // |buf|. An incomplete sequence at the end of |buf| is retained for the next
+  // call.
+  void Split(const void* buf, size_t count, std::string* out);
+
+  // Appends U+FFFD to |out| if a partial sequence is being held back, and
+  // forgets it. Use at end of stream.
+  void Flush(std::string* out);
+
+  // Number of bytes currently held back.
+  size_t pending() const { return pending_size_; }
+
+ private:
+  // Validates as much of |buf| as possible, appending to |out|. Returns the
+  // number of bytes consumed; anything left over is an incomplete sequence.
+  static size_t Decode(const unsigned char* buf, size_t count,
+                       std::string* out);
+
+  // A UTF-8 sequence is at most 4 bytes, so at most 3 are ever held back.
+  unsigned char pending_[4];
+  size_t pending_size_ = 0;
+};
+
+#endif  // MOSH_NACL_UTF8_SPLITTER_H_
@@ -0,0 +1,174 @@
+// utf8_splitter_test.cc - Tests for utf8_splitter.{h,cc}.
+
+// Copyright 2017 Richard Woodbury
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mosh_nacl/utf8_splitter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT(build/c++11)
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "gtest/gtest.h"
+
+using std::string;
+
+namespace {
+
+const string kReplacement = "\xef\xbf\xbd";
+
+// Splits |input| in one go.
+string SplitAll(const string& input) {
+  UTF8Splitter splitter;
+  string out;
+  splitter.Split(input.data(), input.size(), &out);
+  splitter.Flush(&out);
+  return out;
+}
+
+// Splits |input| in chunks of |chunk| bytes, checking that every chunk of
+// output is whole.
+string SplitChunked(const string& input, size_t chunk) {
+  UTF8Splitter splitter;
+  string out;
+  for (size_t i = 0; i < input.size(); i += chunk) {
+    string piece;
+    splitter.Split(input.data() + i, std::min(chunk, input.size() - i),
+                   &piece);
+    EXPECT_EQ(piece, SplitAll(piece)) << "Chunk was not whole UTF-8.";
+    out += piece;
+  }
+  splitter.Flush(&out);
+  return out;
+}
+
+// Builds a stream that looks like typical full-screen terminal output: mostly
+// ASCII and escape sequences, with occasional box drawing and CJK text.
+string MakeTerminalStream(size_t size) {
+  const string lines[] = {
+      "\x1b[1;1H\x1b[K$ ls -l /usr/share/doc | head\r\n",
+      "-rw-r--r-- 1 root root  4096 Jan  1 00:00 README.Debian.gz\r\n",
+      "\x1b[7m top - 12:34:56 up 3 days,  load average: 0.01, 0.05, 0.10",
+      "\x1b[m\r\n",
+      "\xe2\x94\x8c\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80\xe2\x94\x90 "
+      "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e \xf0\x9f\x98\x80\r\n",
+      "\x1b[38;5;208mwarning:\x1b[0m unused variable 'x' [-Wunused]\r\n",
+  };
+  string stream;
+  for (size_t i = 0; stream.size() < size; ++i) {
+    stream += lines[i % (sizeof(lines) / sizeof(lines[0]))];
+  }
+  return stream;
+}
+
+}  // anonymous namespace
+
+TEST(UTF8SplitterTest, ASCIIPassesThrough) {
+  const string input = "Hello, world! \x1b[1;31mred\x1b[m\r\n";
+  EXPECT_EQ(input, SplitAll(input));
+}
+
+TEST(UTF8SplitterTest, ValidMultibytePassesThrough) {
+  const string input =
+      "a\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 \xed\x9f\xbf \xf4\x8f\xbf\xbf";
+  EXPECT_EQ(input, SplitAll(input));
+}
+
+TEST(UTF8SplitterTest, SplitSequencesAreHeldBack) {
+  const string input = MakeTerminalStream(4096);
+  for (size_t chunk = 1; chunk <= 17; ++chunk) {
+    EXPECT_EQ(input, SplitChunked(input, chunk)) << "chunk=" << chunk;
+  }
+}
+
+TEST(UTF8SplitterTest, PendingBytes) {
+  UTF8Splitter splitter;
+  string out;
+  splitter.Split("ab\xe2\x82", 4, &out);
+  EXPECT_EQ("ab", out);
+  EXPECT_EQ(2, splitter.pending());
+  splitter.Split("\xac", 1, &out);
+  EXPECT_EQ("ab\xe2\x82\xac", out);
+  EXPECT_EQ(0, splitter.pending());
+}
+
+TEST(UTF8SplitterTest, InvalidBytesAreReplaced) {
+  // Lone continuation byte.
+  EXPECT_EQ("a" + kReplacement + "b", SplitAll("a\x80" "b"));
+  // Overlong encoding of '/'.
+  EXPECT_EQ(kReplacement + kReplacement, SplitAll("\xc0\xaf"));
+  // UTF-16 surrogate.
+  EXPECT_EQ(kReplacement + kReplacement + kReplacement,
+            SplitAll("\xed\xa0\x80"));
+  // Beyond U+10FFFF.
+  EXPECT_EQ(kReplacement + kReplacement + kReplacement + kReplacement,
+            SplitAll("\xf4\x90\x80\x80"));
+  // Truncated sequence followed by ASCII.
+  EXPECT_EQ(kReplacement + "x", SplitAll("\xe2\x82x"));
+  // Truncated sequence at end of stream.
+  EXPECT_EQ("x" + kReplacement, SplitAll("x\xe2\x82"));
+}
+
+TEST(UTF8SplitterTest, InvalidAcrossChunks) {
+  UTF8Splitter splitter;
+  string out;
+  splitter.Split("\xe2\x82", 2, &out);
+  EXPECT_EQ("", out);
+  splitter.Split("x", 1, &out);
+  EXPECT_EQ(kReplacement + "x", out);
+  EXPECT_EQ(0, splitter.pending());
+}
+
+// Reports throughput over a terminal stream. Set UTF8_SPLITTER_CAPTURE to the
+// path of a captured session (e.g., from script(1)) to use real output instead
+// of the synthesized stream.
+TEST(UTF8SplitterTest, Benchmark) {
+  string stream;
+  const char* capture = getenv("UTF8_SPLITTER_CAPTURE");
+  if (capture != nullptr) {
+    std::ifstream file(capture, std::ios::binary);
+    ASSERT_TRUE(file.good()) << "Cannot read " << capture;
+    stream.assign(std::istreambuf_iterator<char>(file),
+                  std::istreambuf_iterator<char>());
+  } else {
+    stream = MakeTerminalStream(1 << 20);
+  }
+
+  // Mosh writes a frame at a time; 1 kB is typical of an interactive update.
+  const size_t kChunk = 1024;
+  const int kIterations = 20;
+  size_t total = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kIterations; ++i) {
+    UTF8Splitter splitter;
+    for (size_t offset = 0; offset < stream.size(); offset += kChunk) {
+      string out;
+      splitter.Split(stream.data() + offset,
+                     std::min(kChunk, stream.size() - offset), &out);
+      total += out.size();
+    }
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  EXPECT_GE(total, stream.size() * kIterations / 2);
+  printf("UTF8Splitter: %zu bytes in %.3f s (%.1f MB/s)\n",
+         stream.size() * kIterations, elapsed.count(),
+         stream.size() * kIterations / elapsed.count() / 1e6);
+}